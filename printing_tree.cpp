@@ -1,12 +1,57 @@
 #include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <climits>
 #include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <limits>
-#include <queue>
-#include <sstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <random>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Vector kernels for FlatTree reductions; -DTREE_SIMD=0 keeps only the
+// scalar loops
+#ifndef TREE_SIMD
+#define TREE_SIMD 1
+#endif
+#if TREE_SIMD && defined(__GNUC__) && defined(__x86_64__)
+#define TREE_SIMD_X86 1
+#include <immintrin.h>
+#elif TREE_SIMD && defined(__aarch64__) && defined(__ARM_NEON)
+#define TREE_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
 /**
  * 🌲 Binary Tree Visualizer - LeetCode Style
  *
@@ -23,559 +68,5997 @@
 // TreeNode Definition (LeetCode Compatible)
 // ============================================================================
 
-struct TreeNode {
-  int val;
-  TreeNode *left;
-  TreeNode *right;
+// What the tree code needs to know about a value type, fixed at compile
+// time so typed trees pay no dispatch cost
+template <typename T> struct TreeValue {
+  static_assert(std::is_arithmetic_v<T> && !std::is_same_v<T, bool>,
+                "tree values must be integers or floating point");
+
+  // Sums are accumulated in this, so adding up a tree cannot overflow T
+  using Sum = std::conditional_t<
+      std::is_floating_point_v<T>, long double,
+      std::conditional_t<std::is_signed_v<T>, long long, unsigned long long>>;
+
+  // Longest decimal form: digits and sign for integers, shortest
+  // round-trip digits plus sign, point and exponent for floating point
+  static constexpr size_t kMaxWidth =
+      std::is_integral_v<T>
+          ? std::numeric_limits<T>::digits10 + 1 + std::is_signed_v<T>
+          : std::numeric_limits<T>::max_digits10 + 8;
+
+  static std::string_view format(T val, char (&buf)[kMaxWidth]) {
+    auto [end, ec] = std::to_chars(buf, buf + kMaxWidth, val);
+    (void)ec;
+    return std::string_view(buf, end - buf);
+  }
+};
+
+template <typename T> struct BasicTreeNode {
+  T val;
+  BasicTreeNode *left;
+  BasicTreeNode *right;
 
-  TreeNode() : val(0), left(nullptr), right(nullptr) {}
-  TreeNode(int x) : val(x), left(nullptr), right(nullptr) {}
-  TreeNode(int x, TreeNode *left, TreeNode *right)
+  BasicTreeNode() : val(), left(nullptr), right(nullptr) {}
+  BasicTreeNode(T x) : val(x), left(nullptr), right(nullptr) {}
+  BasicTreeNode(T x, BasicTreeNode *left, BasicTreeNode *right)
       : val(x), left(left), right(right) {}
 };
 
+// The LeetCode node. Codec, TreeTraversals and TreeOperations accept any
+// BasicTreeNode<T>; the visualizer and FlatTree work on this one.
+using TreeNode = BasicTreeNode<int>;
+
+// A tree as stored, or its mirror image. Reading through a mirrored view
+// swaps left and right, so mirroring is O(1) and copies nothing, and any
+// number of views, mirrored or not, can share the same nodes.
+template <typename T> class BasicTreeView {
+public:
+  BasicTreeView() = default;
+  BasicTreeView(BasicTreeNode<T> *root, bool mirrored = false)
+      : root(root), flipped(mirrored) {}
+
+  BasicTreeNode<T> *node() const { return root; }
+  bool mirrored() const { return flipped; }
+  explicit operator bool() const { return root != nullptr; }
+  const T &val() const { return root->val; }
+
+  BasicTreeView left() const {
+    return {flipped ? root->right : root->left, flipped};
+  }
+  BasicTreeView right() const {
+    return {flipped ? root->left : root->right, flipped};
+  }
+  BasicTreeView mirror() const { return {root, !flipped}; }
+
+private:
+  BasicTreeNode<T> *root = nullptr;
+  bool flipped = false;
+};
+
+using TreeView = BasicTreeView<int>;
+
 // ============================================================================
-// Tree Serializer/Deserializer (LeetCode Style)
+// Level-Order Engine
 // ============================================================================
 
-class Codec {
+// Every breadth-first pass in this file, whether it reads a tree (Codec
+// serialization, FlatTree::fromTree, TreeTraversals) or builds one (the
+// parsers), keeps its frontier here as two arrays. One holds the level
+// being read, left to right, and the other collects the next level.
+// advance() swaps them, so a pass stops allocating once it has seen its
+// widest level.
+template <typename Handle> class LevelFrontier {
 public:
-  // Serialize tree to LeetCode format: [1,2,3,null,null,4,5]
-  static std::string serialize(TreeNode *root) {
-    if (!root)
-      return "[]";
+  explicit LevelFrontier(Handle root) { current.push_back(root); }
 
-    std::string result = "[";
-    std::queue<TreeNode *> q;
-    q.push(root);
+  const std::vector<Handle> &level() const { return current; }
+  int depth() const { return levelDepth; } // Root level is 0
 
-    std::vector<std::string> values;
+  void push(Handle handle) { next.push_back(handle); }
 
-    while (!q.empty()) {
-      TreeNode *node = q.front();
-      q.pop();
+  // Move on to the level collected so far; false once it is empty
+  bool advance() {
+    current.swap(next);
+    next.clear();
+    levelDepth++;
+    return !current.empty();
+  }
 
-      if (node) {
-        values.push_back(std::to_string(node->val));
-        q.push(node->left);
-        q.push(node->right);
-      } else {
-        values.push_back("null");
-      }
+private:
+  std::vector<Handle> current, next;
+  int levelDepth = 0;
+};
+
+// visit(nodes, depth) once per level with that level's nodes, left to
+// right, until visit returns false
+template <typename T, typename Visit>
+bool forEachTreeLevel(BasicTreeNode<T> *root, Visit &&visit) {
+  if (!root)
+    return true;
+  LevelFrontier<BasicTreeNode<T> *> frontier(root);
+  do {
+    if (!visit(frontier.level(), frontier.depth()))
+      return false;
+    for (BasicTreeNode<T> *node : frontier.level()) {
+      if (node->left)
+        frontier.push(node->left);
+      if (node->right)
+        frontier.push(node->right);
+    }
+  } while (frontier.advance());
+  return true;
+}
+
+// ============================================================================
+// Tree Arena (chunked node pool)
+// ============================================================================
+
+// Hands out TreeNodes from large contiguous chunks. Nodes are never freed
+// one by one: clear() recycles every chunk for the next tree and the
+// destructor returns them all at once. Trees built here must not be passed
+// to TreeOperations::deleteTree.
+template <typename T> class BasicTreeArena {
+public:
+  using Node = BasicTreeNode<T>;
+
+  explicit BasicTreeArena(size_t firstChunkNodes = 1024)
+      : nextChunkNodes(std::max<size_t>(1, firstChunkNodes)) {}
+
+  ~BasicTreeArena() { release(); }
+
+  BasicTreeArena(const BasicTreeArena &) = delete;
+  BasicTreeArena &operator=(const BasicTreeArena &) = delete;
+
+  BasicTreeArena(BasicTreeArena &&other) noexcept { *this = std::move(other); }
+
+  BasicTreeArena &operator=(BasicTreeArena &&other) noexcept {
+    if (this != &other) {
+      release();
+      chunks = std::move(other.chunks);
+      current = other.current;
+      used = other.used;
+      count = other.count;
+      nextChunkNodes = other.nextChunkNodes;
+      other.chunks.clear();
+      other.current = other.used = other.count = 0;
     }
+    return *this;
+  }
+
+  Node *create(T val, Node *left = nullptr, Node *right = nullptr) {
+    if (chunks.empty() || used == chunks[current].capacity)
+      advance();
+    Node *slot = chunks[current].nodes + used++;
+    count++;
+    return new (slot) Node(val, left, right);
+  }
 
-    // Remove trailing nulls
-    while (!values.empty() && values.back() == "null") {
-      values.pop_back();
+  // Forget every node but keep the chunks for reuse
+  void clear() {
+    current = used = count = 0;
+  }
+
+  // Forget every node and give the memory back
+  void release() {
+    for (auto &chunk : chunks)
+      ::operator delete(chunk.nodes);
+    chunks.clear();
+    current = used = count = 0;
+  }
+
+  // Make sure the next n nodes need no further allocation
+  void reserve(size_t n) {
+    size_t spare = 0;
+    if (!chunks.empty()) {
+      spare = chunks[current].capacity - used;
+      for (size_t i = current + 1; i < chunks.size(); i++)
+        spare += chunks[i].capacity;
     }
+    if (spare < n)
+      addChunk(n - spare);
+  }
 
-    for (size_t i = 0; i < values.size(); i++) {
-      result += values[i];
-      if (i < values.size() - 1)
-        result += ",";
+  size_t size() const { return count; }
+
+  size_t capacity() const {
+    size_t total = 0;
+    for (auto &chunk : chunks)
+      total += chunk.capacity;
+    return total;
+  }
+
+private:
+  struct Chunk {
+    Node *nodes;
+    size_t capacity;
+  };
+
+  static constexpr size_t kMaxChunkNodes = size_t(1) << 20;
+
+  // Move to the next recycled chunk, or allocate a bigger one
+  void advance() {
+    if (!chunks.empty() && current + 1 < chunks.size()) {
+      current++;
+    } else {
+      addChunk(nextChunkNodes);
+      current = chunks.size() - 1;
+      nextChunkNodes = std::min(nextChunkNodes * 2, kMaxChunkNodes);
     }
+    used = 0;
+  }
 
-    return result + "]";
+  void addChunk(size_t nodes) {
+    void *mem = ::operator new(nodes * sizeof(Node));
+    chunks.push_back({static_cast<Node *>(mem), nodes});
   }
 
-  // Deserialize LeetCode format to tree: [1,2,3,null,null,4,5]
-  static TreeNode *deserialize(const std::string &data) {
-    if (data.empty() || data == "[]")
-      return nullptr;
+  std::vector<Chunk> chunks;
+  size_t current = 0; // Chunk that create() is filling
+  size_t used = 0;    // Nodes taken from the current chunk
+  size_t count = 0;
+  size_t nextChunkNodes;
+};
 
-    // Parse the input
-    std::string cleanData = data;
-    // Remove brackets and spaces
-    cleanData.erase(std::remove(cleanData.begin(), cleanData.end(), '['),
-                    cleanData.end());
-    cleanData.erase(std::remove(cleanData.begin(), cleanData.end(), ']'),
-                    cleanData.end());
-    cleanData.erase(std::remove(cleanData.begin(), cleanData.end(), ' '),
-                    cleanData.end());
-
-    if (cleanData.empty())
-      return nullptr;
+using TreeArena = BasicTreeArena<int>;
+
+// ============================================================================
+// Flat Tree (struct-of-arrays, BFS order)
+// ============================================================================
+
+// Read-only window onto contiguous elements owned by someone else
+template <typename T> class ArrayView {
+public:
+  ArrayView() = default;
+  ArrayView(const T *data, size_t size) : ptr(data), count(size) {}
+
+  const T *begin() const { return ptr; }
+  const T *end() const { return ptr + count; }
+  const T *data() const { return ptr; }
+  const T &operator[](size_t i) const { return ptr[i]; }
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+
+private:
+  const T *ptr = nullptr;
+  size_t count = 0;
+};
 
-    std::vector<std::string> values;
-    std::stringstream ss(cleanData);
-    std::string token;
+// Nodes stored level by level in three parallel arrays, root at index 0.
+// Children are 32-bit indices (FlatTree::npos when absent), which halves
+// the per-node footprint of TreeNode and keeps full scans sequential.
+// Nodes must be added in BFS order: every child comes after its parent and
+// the children of one level directly follow that level.
+//
+// A FlatTree either owns its arrays or is a read-only view over arrays
+// kept alive elsewhere, such as a memory-mapped file (see MappedTree).
+class FlatTree {
+public:
+  static constexpr uint32_t npos = UINT32_MAX;
+
+  FlatTree() = default;
+
+  FlatTree(const FlatTree &other) { *this = other; }
+  FlatTree(FlatTree &&other) noexcept { *this = std::move(other); }
+
+  FlatTree &operator=(const FlatTree &other) {
+    if (this != &other) {
+      vals = other.vals;
+      lefts = other.lefts;
+      rights = other.rights;
+      adopt(other);
+    }
+    return *this;
+  }
 
-    while (std::getline(ss, token, ',')) {
-      values.push_back(token);
+  FlatTree &operator=(FlatTree &&other) noexcept {
+    if (this != &other) {
+      vals = std::move(other.vals);
+      lefts = std::move(other.lefts);
+      rights = std::move(other.rights);
+      adopt(other);
+      other.clear();
     }
+    return *this;
+  }
 
-    if (values.empty() || values[0] == "null")
-      return nullptr;
+  // Wrap existing arrays without copying; they must outlive the view
+  static FlatTree view(const int *values, const uint32_t *lefts,
+                       const uint32_t *rights, size_t n) {
+    FlatTree tree;
+    tree.valsData = values;
+    tree.leftData = lefts;
+    tree.rightData = rights;
+    tree.count = n;
+    tree.readOnly = true;
+    return tree;
+  }
 
-    TreeNode *root = new TreeNode(std::stoi(values[0]));
-    std::queue<TreeNode *> q;
-    q.push(root);
+  // Take ownership of ready-made BFS-ordered arrays of equal length
+  static FlatTree fromArrays(std::vector<int> values,
+                             std::vector<uint32_t> lefts,
+                             std::vector<uint32_t> rights) {
+    FlatTree tree;
+    tree.vals = std::move(values);
+    tree.lefts = std::move(lefts);
+    tree.rights = std::move(rights);
+    tree.sync();
+    return tree;
+  }
 
-    size_t i = 1;
-    while (!q.empty() && i < values.size()) {
-      TreeNode *node = q.front();
-      q.pop();
+  // Flatten a linked tree, or a mirrored view of one, in level order
+  static FlatTree fromTree(TreeView root) {
+    FlatTree tree;
+    if (!root)
+      return tree;
 
-      // Left child
-      if (i < values.size() && values[i] != "null") {
-        node->left = new TreeNode(std::stoi(values[i]));
-        q.push(node->left);
-      }
-      i++;
+    LevelFrontier<TreeView> frontier(root);
+    tree.addNode(root.val());
 
-      // Right child
-      if (i < values.size() && values[i] != "null") {
-        node->right = new TreeNode(std::stoi(values[i]));
-        q.push(node->right);
+    uint32_t i = 0;
+    do {
+      for (TreeView node : frontier.level()) {
+        if (TreeView left = node.left()) {
+          tree.setLeft(i, tree.addNode(left.val()));
+          frontier.push(left);
+        }
+        if (TreeView right = node.right()) {
+          tree.setRight(i, tree.addNode(right.val()));
+          frontier.push(right);
+        }
+        i++;
       }
-      i++;
+    } while (frontier.advance());
+    return tree;
+  }
+
+  // Rebuild a linked tree; the caller owns the nodes
+  TreeNode *toTree() const {
+    return build([](int val) { return new TreeNode(val); });
+  }
+
+  TreeNode *toTree(TreeArena &arena) const {
+    arena.reserve(size());
+    return build([&arena](int val) { return arena.create(val); });
+  }
+
+  uint32_t addNode(int val) {
+    checkWritable();
+    if (vals.size() >= npos)
+      throw std::length_error("FlatTree: too many nodes");
+    vals.push_back(val);
+    lefts.push_back(npos);
+    rights.push_back(npos);
+    sync();
+    return static_cast<uint32_t>(vals.size() - 1);
+  }
+
+  void setLeft(uint32_t parent, uint32_t child) {
+    checkWritable();
+    lefts[parent] = child;
+  }
+
+  void setRight(uint32_t parent, uint32_t child) {
+    checkWritable();
+    rights[parent] = child;
+  }
+
+  void reserve(size_t n) {
+    checkWritable();
+    vals.reserve(n);
+    lefts.reserve(n);
+    rights.reserve(n);
+    sync();
+  }
+
+  // Empty the tree; a view becomes an empty owning tree
+  void clear() {
+    vals.clear();
+    lefts.clear();
+    rights.clear();
+    readOnly = false;
+    sync();
+  }
+
+  bool empty() const { return count == 0; }
+  size_t size() const { return count; }
+  bool isView() const { return readOnly; }
+
+  int value(uint32_t i) const { return valsData[i]; }
+  uint32_t left(uint32_t i) const { return leftData[i]; }
+  uint32_t right(uint32_t i) const { return rightData[i]; }
+
+  ArrayView<int> values() const { return {valsData, count}; }
+  ArrayView<uint32_t> leftIndices() const { return {leftData, count}; }
+  ArrayView<uint32_t> rightIndices() const { return {rightData, count}; }
+
+  // Number of levels. Each BFS level is a contiguous run whose children
+  // form the next run, so this needs no per-node scratch memory.
+  int levels() const {
+    int result = 0;
+    size_t begin = 0, end = empty() ? 0 : 1;
+    while (begin < end) {
+      size_t children = 0;
+      for (size_t i = begin; i < end; i++)
+        children += (leftData[i] != npos) + (rightData[i] != npos);
+      result++;
+      begin = end;
+      end += children;
     }
+    return result;
+  }
 
-    return root;
+private:
+  void checkWritable() const {
+    if (readOnly)
+      throw std::logic_error("FlatTree: view is read-only");
+  }
+
+  void sync() {
+    valsData = vals.data();
+    leftData = lefts.data();
+    rightData = rights.data();
+    count = vals.size();
   }
+
+  // Point at our own arrays, or share the other tree's external ones
+  void adopt(const FlatTree &other) {
+    readOnly = other.readOnly;
+    if (readOnly) {
+      valsData = other.valsData;
+      leftData = other.leftData;
+      rightData = other.rightData;
+      count = other.count;
+    } else {
+      sync();
+    }
+  }
+
+  template <typename NewNode> TreeNode *build(NewNode &&makeNode) const {
+    if (empty())
+      return nullptr;
+    std::vector<TreeNode *> nodes(size());
+    for (size_t i = 0; i < size(); i++)
+      nodes[i] = makeNode(valsData[i]);
+    // Children always follow their parent, so every target already exists
+    for (size_t i = 0; i < size(); i++) {
+      if (leftData[i] != npos)
+        nodes[i]->left = nodes[leftData[i]];
+      if (rightData[i] != npos)
+        nodes[i]->right = nodes[rightData[i]];
+    }
+    return nodes[0];
+  }
+
+  std::vector<int> vals;
+  std::vector<uint32_t> lefts;
+  std::vector<uint32_t> rights;
+
+  const int *valsData = nullptr;
+  const uint32_t *leftData = nullptr;
+  const uint32_t *rightData = nullptr;
+  size_t count = 0;
+  bool readOnly = false;
 };
 
 // ============================================================================
-// Tree Visualizer
+// Vector Kernels
 // ============================================================================
 
-class TreeVisualizer {
-private:
-  // Get the height of the tree
-  static int getHeight(TreeNode *root) {
-    if (!root)
-      return 0;
-    return 1 + std::max(getHeight(root->left), getHeight(root->right));
+// Reductions over FlatTree's arrays: a scalar loop, plus AVX2 and AVX-512
+// on x86-64 and NEON on aarch64. best() picks the widest one the CPU runs,
+// once. They are all exact integer reductions, so every table returns the
+// same result as the scalar one and as the pointer-based TreeOperations.
+class VectorKernels {
+public:
+  enum class Isa { Scalar, Neon, Avx2, Avx512 };
+  static constexpr Isa kAll[] = {Isa::Scalar, Isa::Neon, Isa::Avx2,
+                                 Isa::Avx512};
+
+  struct Table {
+    const char *name;
+    long long (*sum)(const int *values, size_t n);
+    int (*min)(const int *values, size_t n); // INT_MAX when n == 0
+    int (*max)(const int *values, size_t n); // INT_MIN when n == 0
+    size_t (*countLeaves)(const uint32_t *lefts, const uint32_t *rights,
+                          size_t n);
+  };
+
+  static bool supported(Isa isa) {
+    switch (isa) {
+    case Isa::Scalar:
+      return true;
+#if defined(TREE_SIMD_NEON)
+    case Isa::Neon:
+      return true;
+#endif
+#if defined(TREE_SIMD_X86)
+    case Isa::Avx2:
+      return __builtin_cpu_supports("avx2");
+    case Isa::Avx512:
+      return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+      return false;
+    }
   }
 
-  // Get maximum width of node values in tree
-  static int getMaxWidth(TreeNode *root) {
-    if (!root)
-      return 1;
-    int current = std::to_string(root->val).length();
-    int leftMax = getMaxWidth(root->left);
-    int rightMax = getMaxWidth(root->right);
-    return std::max({static_cast<int>(current), leftMax, rightMax});
+  // Kernels for isa, which must be supported()
+  static const Table &table(Isa isa) {
+    static const Table scalar = {"scalar", sumScalar, extremeScalar<false>,
+                                 extremeScalar<true>, leavesScalar};
+#if defined(TREE_SIMD_NEON)
+    static const Table neon = {"neon", sumNeon, extremeNeon<false>,
+                               extremeNeon<true>, leavesNeon};
+    if (isa == Isa::Neon)
+      return neon;
+#endif
+#if defined(TREE_SIMD_X86)
+    static const Table avx2 = {"avx2", sumAvx2, extremeAvx2<false>,
+                               extremeAvx2<true>, leavesAvx2};
+    static const Table avx512 = {"avx512", sumAvx512, extremeAvx512<false>,
+                                 extremeAvx512<true>, leavesAvx512};
+    if (isa == Isa::Avx2)
+      return avx2;
+    if (isa == Isa::Avx512)
+      return avx512;
+#endif
+    return scalar;
   }
 
-  // Helper to center a string within a given width
-  static std::string centerStr(const std::string &s, int width) {
-    if (static_cast<int>(s.length()) >= width)
-      return s;
-    int padding = width - s.length();
-    int leftPad = padding / 2;
-    int rightPad = padding - leftPad;
-    return std::string(leftPad, ' ') + s + std::string(rightPad, ' ');
+  static const Table &best() {
+    static const Table &chosen = []() -> const Table & {
+      for (size_t i = std::size(kAll); i-- > 0;)
+        if (supported(kAll[i]))
+          return table(kAll[i]);
+      return table(Isa::Scalar);
+    }();
+    return chosen;
   }
 
-  // Get all nodes at each level
-  static std::vector<std::vector<TreeNode *>> getLevels(TreeNode *root) {
-    std::vector<std::vector<TreeNode *>> levels;
-    if (!root)
-      return levels;
+private:
+  // A node is a leaf when both child slots hold npos, which is all ones,
+  // so one AND of the two indices tells
+  static_assert(FlatTree::npos == UINT32_MAX, "leaf test needs npos = ~0");
+
+  static long long sumScalar(const int *values, size_t n) {
+    long long total = 0;
+    for (size_t i = 0; i < n; i++)
+      total += values[i];
+    return total;
+  }
 
-    std::queue<TreeNode *> q;
-    q.push(root);
+  template <bool Max> static int extremeScalar(const int *values, size_t n) {
+    int result = Max ? INT_MIN : INT_MAX;
+    for (size_t i = 0; i < n; i++)
+      result = Max ? std::max(result, values[i]) : std::min(result, values[i]);
+    return result;
+  }
 
-    while (!q.empty()) {
-      int size = q.size();
-      std::vector<TreeNode *> level;
+  static size_t leavesScalar(const uint32_t *lefts, const uint32_t *rights,
+                             size_t n) {
+    size_t leaves = 0;
+    for (size_t i = 0; i < n; i++)
+      leaves += (lefts[i] & rights[i]) == FlatTree::npos;
+    return leaves;
+  }
 
-      for (int i = 0; i < size; i++) {
-        TreeNode *node = q.front();
-        q.pop();
-        level.push_back(node);
+  // Each vector kernel covers whole vectors and leaves the tail to the
+  // scalar loop
+
+#if defined(TREE_SIMD_X86)
+  __attribute__((target("avx2"))) static long long sumAvx2(const int *values,
+                                                           size_t n) {
+    __m256i low = _mm256_setzero_si256(), high = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      __m256i v = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(values + i));
+      low = _mm256_add_epi64(low,
+                             _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+      high = _mm256_add_epi64(
+          high, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+    }
+    alignas(32) long long lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes),
+                       _mm256_add_epi64(low, high));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+           sumScalar(values + i, n - i);
+  }
 
-        if (node) {
-          q.push(node->left);
-          q.push(node->right);
-        }
-      }
+  template <bool Max>
+  __attribute__((target("avx2"))) static int extremeAvx2(const int *values,
+                                                         size_t n) {
+    __m256i acc = _mm256_set1_epi32(Max ? INT_MIN : INT_MAX);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      __m256i v = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(values + i));
+      acc = Max ? _mm256_max_epi32(acc, v) : _mm256_min_epi32(acc, v);
+    }
+    alignas(32) int lanes[8];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), acc);
+    int result = extremeScalar<Max>(values + i, n - i);
+    for (int lane : lanes)
+      result = Max ? std::max(result, lane) : std::min(result, lane);
+    return result;
+  }
 
-      // Check if all nulls
-      bool allNull = true;
-      for (auto n : level) {
-        if (n) {
-          allNull = false;
-          break;
-        }
-      }
-      if (allNull)
-        break;
+  __attribute__((target("avx2,popcnt"))) static size_t
+  leavesAvx2(const uint32_t *lefts, const uint32_t *rights, size_t n) {
+    const __m256i none = _mm256_set1_epi32(-1);
+    size_t leaves = 0, i = 0;
+    for (; i + 8 <= n; i += 8) {
+      __m256i both = _mm256_and_si256(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(lefts + i)),
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rights + i)));
+      __m256 leaf = _mm256_castsi256_ps(_mm256_cmpeq_epi32(both, none));
+      leaves += __builtin_popcount(_mm256_movemask_ps(leaf));
+    }
+    return leaves + leavesScalar(lefts + i, rights + i, n - i);
+  }
 
-      levels.push_back(level);
+  // GCC 12 seeds several AVX-512 intrinsics with a self-initialised
+  // _mm512_undefined_epi32(), which trips its own uninitialised warnings
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+  __attribute__((target("avx512f"))) static long long
+  sumAvx512(const int *values, size_t n) {
+    // Widened a half at a time: two 256-bit loads, one 512-bit add each
+    __m512i low = _mm512_setzero_si512(), high = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      auto half = reinterpret_cast<const __m256i *>(values + i);
+      low = _mm512_add_epi64(low,
+                             _mm512_cvtepi32_epi64(_mm256_loadu_si256(half)));
+      high = _mm512_add_epi64(
+          high, _mm512_cvtepi32_epi64(_mm256_loadu_si256(half + 1)));
     }
+    alignas(64) long long lanes[8];
+    _mm512_store_si512(lanes, _mm512_add_epi64(low, high));
+    long long total = sumScalar(values + i, n - i);
+    for (long long lane : lanes)
+      total += lane;
+    return total;
+  }
 
-    return levels;
+  template <bool Max>
+  __attribute__((target("avx512f"))) static int
+  extremeAvx512(const int *values, size_t n) {
+    __m512i acc = _mm512_set1_epi32(Max ? INT_MIN : INT_MAX);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      __m512i v = _mm512_loadu_si512(values + i);
+      acc = Max ? _mm512_max_epi32(acc, v) : _mm512_min_epi32(acc, v);
+    }
+    alignas(64) int lanes[16];
+    _mm512_store_si512(lanes, acc);
+    int result = extremeScalar<Max>(values + i, n - i);
+    for (int lane : lanes)
+      result = Max ? std::max(result, lane) : std::min(result, lane);
+    return result;
   }
 
-public:
-  // Print tree with beautiful ASCII art - handles multi-digit numbers
-  static void print(TreeNode *root) {
-    if (!root) {
-      std::cout << "\n┌─────────────────┐\n";
-      std::cout << "│   Empty Tree    │\n";
-      std::cout << "└─────────────────┘\n";
-      return;
+  __attribute__((target("avx512f,popcnt"))) static size_t
+  leavesAvx512(const uint32_t *lefts, const uint32_t *rights, size_t n) {
+    const __m512i none = _mm512_set1_epi32(-1);
+    size_t leaves = 0, i = 0;
+    for (; i + 16 <= n; i += 16) {
+      __m512i both = _mm512_and_si512(_mm512_loadu_si512(lefts + i),
+                                      _mm512_loadu_si512(rights + i));
+      leaves += __builtin_popcount(_mm512_cmpeq_epi32_mask(both, none));
     }
+    return leaves + leavesScalar(lefts + i, rights + i, n - i);
+  }
+#pragma GCC diagnostic pop
+#endif
+
+#if defined(TREE_SIMD_NEON)
+  static long long sumNeon(const int *values, size_t n) {
+    int64x2_t acc = vdupq_n_s64(0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+      acc = vpadalq_s32(acc, vld1q_s32(values + i));
+    return vaddvq_s64(acc) + sumScalar(values + i, n - i);
+  }
 
-    int height = getHeight(root);
-    int maxNodeWidth = std::max(3, getMaxWidth(root) + 2); // Min 3 for branches
+  template <bool Max> static int extremeNeon(const int *values, size_t n) {
+    int32x4_t acc = vdupq_n_s32(Max ? INT_MIN : INT_MAX);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      int32x4_t v = vld1q_s32(values + i);
+      acc = Max ? vmaxq_s32(acc, v) : vminq_s32(acc, v);
+    }
+    int rest = extremeScalar<Max>(values + i, n - i);
+    return Max ? std::max(rest, vmaxvq_s32(acc))
+               : std::min(rest, vminvq_s32(acc));
+  }
 
-    // Calculate width needed for bottom level
-    int bottomLevelNodes = 1 << (height - 1); // 2^(height-1)
-    int totalWidth = bottomLevelNodes * maxNodeWidth * 2;
+  static size_t leavesNeon(const uint32_t *lefts, const uint32_t *rights,
+                           size_t n) {
+    size_t leaves = 0, i = 0;
+    for (; i + 4 <= n; i += 4) {
+      uint32x4_t both = vandq_u32(vld1q_u32(lefts + i), vld1q_u32(rights + i));
+      uint32x4_t leaf = vceqq_u32(both, vdupq_n_u32(FlatTree::npos));
+      leaves += vaddvq_u32(vshrq_n_u32(leaf, 31));
+    }
+    return leaves + leavesScalar(lefts + i, rights + i, n - i);
+  }
+#endif
+};
+
+// ============================================================================
+// Output Sink
+// ============================================================================
 
-    auto levels = getLevels(root);
+// Collects output in a fixed buffer and hands it to a std::ostream in large
+// blocks, or appends straight to a std::string. Flushed on destruction.
+class OutputSink {
+public:
+  explicit OutputSink(std::ostream &out) : stream(&out) {}
+  explicit OutputSink(std::string &out) : str(&out) {}
 
-    std::cout << "\n";
-    std::string border(totalWidth + 4, '=');
-    std::cout << border << "\n";
+  ~OutputSink() { flush(); }
 
-    for (size_t levelIdx = 0; levelIdx < levels.size(); levelIdx++) {
-      const auto &level = levels[levelIdx];
-      int nodesInLevel = level.size();
-      int spacing = totalWidth / nodesInLevel;
+  OutputSink(const OutputSink &) = delete;
+  OutputSink &operator=(const OutputSink &) = delete;
 
-      // Print node values
-      std::string nodeLine = "";
-      for (auto node : level) {
-        std::string val = node ? std::to_string(node->val) : " ";
-        nodeLine += centerStr(val, spacing);
+  void write(const char *data, size_t n) {
+    total += n;
+    if (str) {
+      str->append(data, n);
+      return;
+    }
+    if (used + n > sizeof(buffer)) {
+      flush();
+      if (n > sizeof(buffer)) {
+        stream->write(data, static_cast<std::streamsize>(n));
+        return;
       }
-      std::cout << "  " << nodeLine << "\n";
+    }
+    std::copy(data, data + n, buffer + used);
+    used += n;
+  }
 
-      // Print branches (if not last level)
-      if (levelIdx < levels.size() - 1) {
-        int branchSpacing = spacing / 2;
-        int branchWidth = std::max(1, branchSpacing / 2);
+  void write(std::string_view text) { write(text.data(), text.size()); }
 
-        // Draw multiple lines of branches for better visual
-        for (int line = 0; line < std::max(1, branchWidth / 2); line++) {
-          std::string branchLine = "";
-          for (auto node : level) {
-            std::string leftBranch = "";
-            std::string rightBranch = "";
-
-            if (node && node->left) {
-              leftBranch = "/";
-            } else {
-              leftBranch = " ";
-            }
+  void put(char c) { write(&c, 1); }
 
-            if (node && node->right) {
-              rightBranch = "\\";
-            } else {
-              rightBranch = " ";
-            }
+  void fill(char c, size_t n) {
+    total += n;
+    if (str) {
+      str->append(n, c);
+      return;
+    }
+    while (n > 0) {
+      if (used == sizeof(buffer))
+        flush();
+      size_t chunk = std::min(n, sizeof(buffer) - used);
+      std::fill_n(buffer + used, chunk, c);
+      used += chunk;
+      n -= chunk;
+    }
+  }
 
-            // Position branches
-            int leftPad = spacing / 2 - line - 2;
-            int midPad = line * 2 + 2;
-            int rightPad = spacing - leftPad - midPad - 2;
+  void writeInt(long long val) {
+    char digits[24];
+    auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), val);
+    (void)ec;
+    write(digits, static_cast<size_t>(end - digits));
+  }
 
-            if (leftPad < 0)
-              leftPad = 0;
-            if (rightPad < 0)
-              rightPad = 0;
+  // Bytes handed to the sink so far, flushed or not
+  size_t written() const { return total; }
 
-            branchLine += std::string(leftPad, ' ') + leftBranch;
-            branchLine += std::string(midPad, ' ') + rightBranch;
-            branchLine += std::string(rightPad, ' ');
-          }
-          std::cout << "  " << branchLine << "\n";
-        }
-      }
+  void flush() {
+    if (stream && used > 0) {
+      stream->write(buffer, static_cast<std::streamsize>(used));
+      used = 0;
     }
+  }
+
+private:
+  std::ostream *stream = nullptr;
+  std::string *str = nullptr;
+  char buffer[1 << 14];
+  size_t used = 0;
+  size_t total = 0;
+};
+
+// ============================================================================
+// Profiling
+// ============================================================================
+
+// Probes in Codec, TreeVisualizer, TreeTraversals and TreeOperations.
+// Build with -DTREE_PROFILE=0 to compile them out; otherwise each costs a
+// relaxed load until TreeProfile::enable() is called.
+#ifndef TREE_PROFILE
+#define TREE_PROFILE 1
+#endif
+
+// Counting allocations means replacing the global operator new, so it is
+// opt-in: build with -DTREE_COUNT_ALLOCATIONS=1 for the profiler's bytes
+// allocated and the --bench allocation column. Otherwise both read 0 and
+// the standard allocator is untouched.
+#ifndef TREE_COUNT_ALLOCATIONS
+#define TREE_COUNT_ALLOCATIONS 0
+#endif
+
+#if TREE_PROFILE && TREE_COUNT_ALLOCATIONS
+// Every global allocation is counted per thread: bytes for the profiler,
+// calls for --bench. Each thread leases a count slot of its own, so
+// counting is a plain store to a line no other thread writes; measure()
+// adds the slots up. A slot keeps its count when its thread exits and
+// goes to the next new thread. Threads beyond kAllocationSlots at once
+// share one atomic overflow count.
+struct alignas(64) AllocationSlot {
+  std::atomic<size_t> count{0};
+};
+
+constexpr size_t kAllocationSlots = 256;
+AllocationSlot gAllocationSlots[kAllocationSlots];
+AllocationSlot gAllocationOverflow;
 
-    std::cout << border << "\n";
+// Slots not leased right now; only touched as threads start and exit
+struct AllocationSlotPool {
+  std::mutex lock;
+  size_t unused = 0; // Slots from here on were never leased
+  size_t freeCount = 0;
+  AllocationSlot *freeSlots[kAllocationSlots] = {};
+};
+AllocationSlotPool gAllocationSlotPool;
+
+struct AllocationLease {
+  AllocationSlot *slot = nullptr;
+
+  AllocationSlot *get() {
+    if (slot)
+      return slot;
+    std::lock_guard<std::mutex> guard(gAllocationSlotPool.lock);
+    AllocationSlotPool &pool = gAllocationSlotPool;
+    if (pool.freeCount)
+      slot = pool.freeSlots[--pool.freeCount];
+    else if (pool.unused < kAllocationSlots)
+      slot = &gAllocationSlots[pool.unused++];
+    else
+      slot = &gAllocationOverflow;
+    return slot;
   }
 
-  // Alternative visualization using box drawing characters
-  static void printBoxed(TreeNode *root) {
-    if (!root) {
-      std::cout << "\n[Empty Tree]\n";
-      return;
+  // Allocations later in thread exit go to the overflow count
+  ~AllocationLease() {
+    if (slot && slot != &gAllocationOverflow) {
+      std::lock_guard<std::mutex> guard(gAllocationSlotPool.lock);
+      gAllocationSlotPool.freeSlots[gAllocationSlotPool.freeCount++] = slot;
     }
+    slot = &gAllocationOverflow;
+  }
+};
 
-    int height = getHeight(root);
-    int maxW = getMaxWidth(root);
+thread_local AllocationLease tAllocationLease;
+thread_local size_t tAllocatedBytes = 0;
+
+inline void countAllocation(size_t size) {
+  tAllocatedBytes += size;
+  AllocationSlot *slot = tAllocationLease.get();
+  constexpr auto relaxed = std::memory_order_relaxed;
+  if (slot == &gAllocationOverflow)
+    slot->count.fetch_add(1, relaxed);
+  else
+    slot->count.store(slot->count.load(relaxed) + 1, relaxed);
+}
 
-    auto levels = getLevels(root);
+void *operator new(size_t size) {
+  countAllocation(size);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
 
-    // Calculate spacing
-    int bottomNodes = 1 << (height - 1);
-    int cellWidth = maxW + 2;
-    int totalWidth = bottomNodes * cellWidth * 2;
+// Out of line, so the compiler does not pair operator new call sites with
+// free() and warn about a mismatch
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void operator delete(void *p) noexcept {
+  std::free(p);
+}
 
-    std::cout << "\n";
-    std::cout << std::string(totalWidth, '-') << "\n";
+void operator delete(void *p, size_t) noexcept { operator delete(p); }
 
-    for (size_t lvl = 0; lvl < levels.size(); lvl++) {
-      int nodesAtLevel = levels[lvl].size();
-      int spacing = totalWidth / nodesAtLevel;
+// Allocations made so far by every thread, and bytes by this one
+inline size_t allocationCount() {
+  size_t total = gAllocationOverflow.count.load(std::memory_order_relaxed);
+  for (const AllocationSlot &slot : gAllocationSlots)
+    total += slot.count.load(std::memory_order_relaxed);
+  return total;
+}
+inline size_t threadAllocatedBytes() { return tAllocatedBytes; }
+#else
+// The standard allocator, uncounted
+inline size_t allocationCount() { return 0; }
+inline size_t threadAllocatedBytes() { return 0; }
+#endif
+
+// Per-operation totals, one entry per probe name
+class TreeProfile {
+public:
+  struct Counters {
+    explicit Counters(const char *name) : name(name) {}
+
+    const char *name;
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> nanos{0};
+    std::atomic<uint64_t> nodes{0};     // Nodes visited or produced
+    std::atomic<uint64_t> allocated{0}; // Bytes from operator new
+    std::atomic<uint64_t> bytesIn{0};
+    std::atomic<uint64_t> bytesOut{0};
+  };
+
+  static void enable(bool on = true) {
+    active().store(on, std::memory_order_relaxed);
+  }
+  static bool enabled() { return active().load(std::memory_order_relaxed); }
+
+  // Probes with the same name share one entry
+  static Counters &counters(const char *name) {
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (Counters &c : reg.all)
+      if (std::string_view(c.name) == name)
+        return c;
+    return reg.all.emplace_back(name);
+  }
 
-      // Print values
-      for (auto node : levels[lvl]) {
-        std::string val = node ? std::to_string(node->val) : "·";
-        std::cout << centerStr(val, spacing);
-      }
-      std::cout << "\n";
+  static void reset() {
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (Counters &c : reg.all)
+      for (auto *field : {&c.calls, &c.nanos, &c.nodes, &c.allocated,
+                          &c.bytesIn, &c.bytesOut})
+        field->store(0, std::memory_order_relaxed);
+  }
 
-      // Print connectors
-      if (lvl < levels.size() - 1) {
-        for (auto node : levels[lvl]) {
-          std::string conn = "";
-          if (node) {
-            if (node->left && node->right)
-              conn = "|+|";
-            else if (node->left)
-              conn = "/  ";
-            else if (node->right)
-              conn = "  \\";
-            else
-              conn = "   ";
-          } else {
-            conn = "  ";
-          }
-          std::cout << centerStr(conn, spacing);
-        }
-        std::cout << "\n";
-      }
+  // Table of every operation that ran at least once
+  static void report(std::ostream &out) {
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    out << "\n📈 Profile:\n";
+    for (const Counters &c : reg.all) {
+      uint64_t calls = c.calls.load(), nanos = c.nanos.load();
+      uint64_t nodes = c.nodes.load();
+      if (!calls)
+        continue;
+      out << "   " << c.name << ": " << calls << " calls, "
+          << nanos / 1000 << " us";
+      if (nodes)
+        out << ", " << nodes << " nodes (" << nanos / nodes << " ns/node)";
+      out << ", " << c.allocated.load() << " B allocated";
+      if (uint64_t in = c.bytesIn.load())
+        out << ", " << in << " B in";
+      if (uint64_t written = c.bytesOut.load())
+        out << ", " << written << " B out";
+      out << "\n";
+    }
+  }
+
+  // The same as one JSON object: {"profile": [{"op": ..., ...}, ...]}
+  static void reportJson(std::ostream &out) {
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    out << "{\"profile\": [";
+    bool first = true;
+    for (const Counters &c : reg.all) {
+      if (!c.calls.load())
+        continue;
+      out << (first ? "\n" : ",\n") << "  {\"op\": \"" << c.name
+          << "\", \"calls\": " << c.calls.load()
+          << ", \"ns\": " << c.nanos.load()
+          << ", \"nodes\": " << c.nodes.load()
+          << ", \"alloc_bytes\": " << c.allocated.load()
+          << ", \"bytes_in\": " << c.bytesIn.load()
+          << ", \"bytes_out\": " << c.bytesOut.load() << "}";
+      first = false;
     }
+    out << "\n]}\n";
+  }
 
-    std::cout << std::string(totalWidth, '-') << "\n";
+private:
+  // Deque, so entries never move once probes hold references to them
+  struct Registry {
+    std::mutex mutex;
+    std::deque<Counters> all;
+  };
+
+  static Registry &registry() {
+    static Registry reg;
+    return reg;
   }
 
-  // Print compact representation - better for large trees
-  static void printCompact(TreeNode *root, const std::string &prefix = "",
-                           bool isLeft = true) {
-    if (!root)
-      return;
+  static std::atomic<bool> &active() {
+    static std::atomic<bool> flag{false};
+    return flag;
+  }
+};
 
-    if (root->right) {
-      printCompact(root->right, prefix + (isLeft ? "│   " : "    "), false);
+// Times one call and adds it to its Counters when profiling is on. Only
+// the outermost probe on a thread records, so print() falling back to
+// printLayout, or a public call made by another, is reported once.
+class ProfileScope {
+public:
+  explicit ProfileScope(TreeProfile::Counters &counters)
+      : counters(TreeProfile::enabled() && depth() == 0 ? &counters
+                                                         : nullptr) {
+    if (this->counters) {
+      depth()++;
+      start = std::chrono::steady_clock::now();
+      allocated = threadAllocatedBytes();
     }
+  }
+
+  ~ProfileScope() {
+    if (!counters)
+      return;
+    depth()--;
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+    constexpr auto relaxed = std::memory_order_relaxed;
+    counters->calls.fetch_add(1, relaxed);
+    counters->nanos.fetch_add(static_cast<uint64_t>(ns.count()), relaxed);
+    counters->nodes.fetch_add(nodeCount, relaxed);
+    counters->allocated.fetch_add(threadAllocatedBytes() - allocated,
+                                  relaxed);
+    counters->bytesIn.fetch_add(inCount, relaxed);
+    size_t written = sink ? sink->written() - sinkStart : 0;
+    counters->bytesOut.fetch_add(written, relaxed);
+  }
+
+  ProfileScope(const ProfileScope &) = delete;
+  ProfileScope &operator=(const ProfileScope &) = delete;
+
+  void nodes(size_t n) { nodeCount += n; }
+  void bytesIn(size_t n) { inCount += n; }
+
+  // Count what the sink receives until this scope ends
+  void output(const OutputSink &sink) {
+    this->sink = &sink;
+    sinkStart = sink.written();
+  }
+
+  // How many probes are open on this thread. Nesting hands the count to
+  // another thread that works on the caller's behalf.
+  static int nesting() { return depth(); }
+
+  struct Nesting {
+    explicit Nesting(int value) : saved(depth()) { depth() = value; }
+    ~Nesting() { depth() = saved; }
+    int saved;
+  };
+
+private:
+  static int &depth() {
+    thread_local int value = 0;
+    return value;
+  }
+
+  TreeProfile::Counters *counters;
+  std::chrono::steady_clock::time_point start;
+  size_t allocated = 0;
+  size_t nodeCount = 0, inCount = 0;
+  const OutputSink *sink = nullptr;
+  size_t sinkStart = 0;
+};
+
+#if TREE_PROFILE
+#define TREE_PROFILE_SCOPE(name)                                               \
+  static TreeProfile::Counters &profileCounters_ =                             \
+      TreeProfile::counters(name);                                             \
+  ProfileScope profileScope_(profileCounters_)
+#define TREE_PROFILE_NODES(n) profileScope_.nodes(n)
+#define TREE_PROFILE_BYTES_IN(n) profileScope_.bytesIn(n)
+#define TREE_PROFILE_OUTPUT(sink) profileScope_.output(sink)
+#else
+#define TREE_PROFILE_SCOPE(name) ((void)0)
+#define TREE_PROFILE_NODES(n) ((void)0)
+#define TREE_PROFILE_BYTES_IN(n) ((void)0)
+#define TREE_PROFILE_OUTPUT(sink) ((void)0)
+#endif
+
+// ============================================================================
+// Tree Serializer/Deserializer (LeetCode Style)
+// ============================================================================
+
+// Knobs for Codec::serializeBinary
+struct BinaryOptions {
+  bool deltaVarint = false; // Zigzag varints of BFS deltas, smaller on disk
+  bool childIndex = false;  // Store child index arrays for zero-copy loads
+};
+
+class Codec {
+  friend class MappedTree;
+  friend class ParallelCodec;
+
+  // Parse targets, defined with the parser further down
+  template <typename T> struct ArenaNode;
+  template <typename MakeNode> struct NodeBuilder;
+  struct FlatBuilder;
+
+public:
+  // Serialize tree to LeetCode format: [1,2,3,null,null,4,5]. Every call
+  // below works for any BasicTreeNode<T>; deserialize takes T explicitly
+  // (int by default) or from the arena it fills.
+  template <typename T>
+  static std::string serialize(BasicTreeNode<T> *root) {
+    std::string result;
+    serialize(root, result);
+    return result;
+  }
+
+  // Append the serialized form to a caller-owned buffer
+  template <typename T>
+  static void serialize(BasicTreeNode<T> *root, std::string &out) {
+    OutputSink sink(out);
+    writeLevelOrder(root, sink);
+  }
+
+  // Stream the serialized form; memory is bounded by the BFS frontier
+  template <typename T>
+  static void serialize(BasicTreeNode<T> *root, std::ostream &out) {
+    OutputSink sink(out);
+    writeLevelOrder(root, sink);
+  }
+
+  // Outcome of the non-throwing deserialize overload
+  struct ParseStatus {
+    enum Error { None, InvalidValue, OutOfRange };
+
+    bool ok = true;
+    Error error = None;
+    size_t offset = 0; // Byte offset of the offending token in the input
+    std::string message;
+  };
+
+  // Deserialize LeetCode format to tree: [1,2,3,null,null,4,5]
+  // Throws std::invalid_argument / std::out_of_range on a bad value, like
+  // the std::stoi based parser it replaces.
+  template <typename T = int>
+  static BasicTreeNode<T> *deserialize(std::string_view data) {
+    ParseStatus status;
+    NodeBuilder<NewNode<T>> builder{NewNode<T>()};
+    parse(data, status, false, builder);
+    if (!status.ok) {
+      release(builder.root);
+      throwError(status);
+    }
+    return builder.root;
+  }
+
+  // Strict, non-throwing variant: any token that is not exactly an integer
+  // or 'null' is reported through status and nullptr is returned.
+  template <typename T = int>
+  static BasicTreeNode<T> *deserialize(std::string_view data,
+                                       ParseStatus &status) {
+    status = ParseStatus();
+    NodeBuilder<NewNode<T>> builder{NewNode<T>()};
+    parse(data, status, true, builder);
+    return status.ok ? builder.root : release(builder.root);
+  }
+
+  // Same as above, but every node comes from the arena. On error the
+  // partial tree stays in the arena until it is cleared.
+  template <typename T>
+  static BasicTreeNode<T> *deserialize(std::string_view data,
+                                       BasicTreeArena<T> &arena) {
+    ParseStatus status;
+    NodeBuilder<ArenaNode<T>> builder{ArenaNode<T>{arena}};
+    parse(data, status, false, builder);
+    if (!status.ok)
+      throwError(status);
+    return builder.root;
+  }
+
+  template <typename T>
+  static BasicTreeNode<T> *deserialize(std::string_view data,
+                                       BasicTreeArena<T> &arena,
+                                       ParseStatus &status) {
+    status = ParseStatus();
+    NodeBuilder<ArenaNode<T>> builder{ArenaNode<T>{arena}};
+    parse(data, status, true, builder);
+    return status.ok ? builder.root : nullptr;
+  }
+
+  // Parse straight into the flat representation, skipping TreeNode
+  static FlatTree deserializeFlat(std::string_view data) {
+    ParseStatus status;
+    FlatTree tree;
+    FlatBuilder builder{tree};
+    parse(data, status, false, builder);
+    if (!status.ok)
+      throwError(status);
+    return tree;
+  }
+
+  static FlatTree deserializeFlat(std::string_view data, ParseStatus &status) {
+    status = ParseStatus();
+    FlatTree tree;
+    FlatBuilder builder{tree};
+    parse(data, status, true, builder);
+    if (!status.ok)
+      tree.clear();
+    return tree;
+  }
+
+  // Push parsers for input that arrives in pieces; defined after Codec
+  template <typename Builder> class StreamParser;
+  template <typename T>
+  using ArenaStream = StreamParser<NodeBuilder<ArenaNode<T>>>;
+  using FlatStream = StreamParser<FlatBuilder>;
+
+  // Binary layout (little-endian, every section starts 8-byte aligned):
+  //   "TREB", u16 version, u16 flags, u64 node count, u32 height, u32 0
+  //   u64 words: presence bitmap over the 2n+1 LeetCode slots in BFS order
+  //   values: i32[n], or u64 byte length + zigzag delta varints
+  //   children (flag 2 only): u32 left[n], u32 right[n]
+  static void serializeBinary(const FlatTree &tree, std::ostream &out,
+                              const BinaryOptions &options = BinaryOptions()) {
+    OutputSink sink(out);
+    writeBinary(tree, sink, options);
+  }
+
+  static void serializeBinary(const FlatTree &tree, std::string &out,
+                              const BinaryOptions &options = BinaryOptions()) {
+    OutputSink sink(out);
+    writeBinary(tree, sink, options);
+  }
+
+  static std::string
+  serializeBinary(TreeNode *root,
+                  const BinaryOptions &options = BinaryOptions()) {
+    std::string result;
+    serializeBinary(FlatTree::fromTree(root), result, options);
+    return result;
+  }
+
+  // Decode a binary image into an owning FlatTree. Throws
+  // std::runtime_error if the image is truncated or inconsistent.
+  static FlatTree deserializeBinary(std::string_view bytes) {
+    TREE_PROFILE_SCOPE("Codec::deserializeBinary");
+    TREE_PROFILE_BYTES_IN(bytes.size());
+    BinaryLayout layout = readLayout(bytes);
+    TREE_PROFILE_NODES(layout.count);
+    std::vector<int> values;
+    std::vector<uint32_t> lefts, rights;
+    decodeValues(layout, values);
+    decodeChildren(layout, lefts, rights);
+    return FlatTree::fromArrays(std::move(values), std::move(lefts),
+                                std::move(rights));
+  }
+
+private:
+  enum BinaryFlags : uint16_t { kDeltaVarint = 1, kChildIndex = 2 };
+
+  static constexpr uint16_t kBinaryVersion = 1;
+  static constexpr size_t kBinaryHeaderSize = 24;
+
+  // Sections of a validated binary image
+  struct BinaryLayout {
+    uint16_t flags = 0;
+    size_t count = 0;
+    uint32_t height = 0;
+    const unsigned char *bitmap = nullptr;
+    const unsigned char *values = nullptr;
+    size_t valueBytes = 0;
+    const unsigned char *lefts = nullptr;
+    const unsigned char *rights = nullptr;
+  };
+
+  static size_t align8(size_t n) { return (n + 7) & ~size_t(7); }
+
+  static void putLE(OutputSink &sink, uint64_t val, int bytes) {
+    char buf[8];
+    for (int i = 0; i < bytes; i++)
+      buf[i] = static_cast<char>((val >> (8 * i)) & 0xff);
+    sink.write(buf, bytes);
+  }
+
+  static uint64_t getLE(const unsigned char *p, int bytes) {
+    uint64_t val = 0;
+    for (int i = 0; i < bytes; i++)
+      val |= uint64_t(p[i]) << (8 * i);
+    return val;
+  }
+
+  static void pad8(OutputSink &sink, size_t written) {
+    sink.fill('\0', align8(written) - written);
+  }
+
+  static void writeBinary(const FlatTree &tree, OutputSink &sink,
+                          const BinaryOptions &options) {
+    TREE_PROFILE_SCOPE("Codec::serializeBinary");
+    TREE_PROFILE_OUTPUT(sink);
+    size_t n = tree.size();
+    TREE_PROFILE_NODES(n);
+    uint16_t flags = (options.deltaVarint ? kDeltaVarint : 0) |
+                     (options.childIndex ? kChildIndex : 0);
+    sink.write("TREB", 4);
+    putLE(sink, kBinaryVersion, 2);
+    putLE(sink, flags, 2);
+    putLE(sink, n, 8);
+    putLE(sink, static_cast<uint32_t>(tree.levels()), 4);
+    putLE(sink, 0, 4);
+
+    // Slot 0 is the root, slots 2i+1 and 2i+2 the children of node i
+    size_t slots = 2 * n + 1;
+    uint64_t word = n > 0 ? 1 : 0;
+    for (size_t slot = 1; slot < slots; slot++) {
+      size_t node = (slot - 1) / 2;
+      uint32_t child = slot % 2 ? tree.left(node) : tree.right(node);
+      if (child != FlatTree::npos)
+        word |= uint64_t(1) << (slot % 64);
+      if (slot % 64 == 63) {
+        putLE(sink, word, 8);
+        word = 0;
+      }
+    }
+    if (slots % 64 != 0)
+      putLE(sink, word, 8);
+
+    if (options.deltaVarint) {
+      std::string bytes;
+      long long prev = 0;
+      for (int v : tree.values()) {
+        long long delta = v - prev;
+        uint64_t zigzag = (uint64_t(delta) << 1) ^ uint64_t(delta >> 63);
+        prev = v;
+        do {
+          unsigned char byte = zigzag & 0x7f;
+          zigzag >>= 7;
+          bytes.push_back(static_cast<char>(byte | (zigzag ? 0x80 : 0)));
+        } while (zigzag);
+      }
+      putLE(sink, bytes.size(), 8);
+      sink.write(bytes);
+      pad8(sink, bytes.size());
+    } else {
+      for (int v : tree.values())
+        putLE(sink, static_cast<uint32_t>(v), 4);
+      pad8(sink, 4 * n);
+    }
+
+    if (options.childIndex) {
+      for (uint32_t c : tree.leftIndices())
+        putLE(sink, c, 4);
+      pad8(sink, 4 * n);
+      for (uint32_t c : tree.rightIndices())
+        putLE(sink, c, 4);
+      pad8(sink, 4 * n);
+    }
+  }
+
+  [[noreturn]] static void binaryError(const char *what) {
+    throw std::runtime_error(std::string("Codec::deserializeBinary: ") +
+                             what);
+  }
+
+  static BinaryLayout readLayout(std::string_view bytes) {
+    auto base = reinterpret_cast<const unsigned char *>(bytes.data());
+    size_t size = bytes.size();
+    if (size < kBinaryHeaderSize || bytes.substr(0, 4) != "TREB")
+      binaryError("not a binary tree image");
+    if (getLE(base + 4, 2) != kBinaryVersion)
+      binaryError("unsupported version");
+
+    BinaryLayout layout;
+    layout.flags = static_cast<uint16_t>(getLE(base + 6, 2));
+    uint64_t count = getLE(base + 8, 8);
+    layout.height = static_cast<uint32_t>(getLE(base + 16, 4));
+    if (count >= FlatTree::npos || count > size)
+      binaryError("bad node count");
+    layout.count = static_cast<size_t>(count);
+
+    // Walk the sections, checking each one fits before pointing at it
+    size_t pos = kBinaryHeaderSize;
+    auto take = [&](size_t n) {
+      if (n > size - pos)
+        binaryError("truncated image");
+      const unsigned char *p = base + pos;
+      pos += align8(n);
+      pos = std::min(pos, size);
+      return p;
+    };
+
+    size_t n = layout.count;
+    layout.bitmap = take(8 * ((2 * n + 1 + 63) / 64));
+    if (layout.flags & kDeltaVarint) {
+      layout.valueBytes = static_cast<size_t>(getLE(take(8), 8));
+      layout.values = take(layout.valueBytes);
+    } else {
+      layout.valueBytes = 4 * n;
+      layout.values = take(layout.valueBytes);
+    }
+    if (layout.flags & kChildIndex) {
+      layout.lefts = take(4 * n);
+      layout.rights = take(4 * n);
+    }
+    return layout;
+  }
+
+  static void decodeValues(const BinaryLayout &layout,
+                           std::vector<int> &values) {
+    values.resize(layout.count);
+    if (!(layout.flags & kDeltaVarint)) {
+      for (size_t i = 0; i < layout.count; i++)
+        values[i] = static_cast<int32_t>(getLE(layout.values + 4 * i, 4));
+      return;
+    }
+
+    const unsigned char *p = layout.values;
+    const unsigned char *end = p + layout.valueBytes;
+    long long prev = 0;
+    for (size_t i = 0; i < layout.count; i++) {
+      uint64_t zigzag = 0;
+      for (int shift = 0;; shift += 7) {
+        if (p == end || shift > 63)
+          binaryError("bad varint");
+        zigzag |= uint64_t(*p & 0x7f) << shift;
+        if (!(*p++ & 0x80))
+          break;
+      }
+      long long delta = static_cast<long long>(zigzag >> 1) ^
+                        -static_cast<long long>(zigzag & 1);
+      prev += delta;
+      values[i] = static_cast<int>(prev);
+    }
+  }
+
+  // Child indices from the stored arrays, or else from the bitmap: the
+  // k-th present slot after the root is node k
+  static void decodeChildren(const BinaryLayout &layout,
+                             std::vector<uint32_t> &lefts,
+                             std::vector<uint32_t> &rights) {
+    size_t n = layout.count;
+    lefts.assign(n, FlatTree::npos);
+    rights.assign(n, FlatTree::npos);
+    if (layout.flags & kChildIndex) {
+      for (size_t i = 0; i < n; i++) {
+        lefts[i] = static_cast<uint32_t>(getLE(layout.lefts + 4 * i, 4));
+        rights[i] = static_cast<uint32_t>(getLE(layout.rights + 4 * i, 4));
+      }
+      verifyChildren(lefts.data(), rights.data(), n);
+      return;
+    }
+
+    auto present = [&](size_t slot) {
+      return (layout.bitmap[slot / 8] >> (slot % 8)) & 1;
+    };
+    if (present(0) != (n > 0))
+      binaryError("bitmap does not match node count");
+    size_t next = 1;
+    for (size_t i = 0; i < n; i++) {
+      if (present(2 * i + 1)) {
+        if (next >= n)
+          binaryError("bitmap does not match node count");
+        lefts[i] = static_cast<uint32_t>(next++);
+      }
+      if (present(2 * i + 2)) {
+        if (next >= n)
+          binaryError("bitmap does not match node count");
+        rights[i] = static_cast<uint32_t>(next++);
+      }
+    }
+    if (n > 0 && next != n)
+      binaryError("bitmap does not match node count");
+  }
+
+  // Stored indices must number the children 1, 2, 3... in BFS order, so
+  // every node has exactly one parent
+  static void verifyChildren(const uint32_t *lefts, const uint32_t *rights,
+                             size_t n) {
+    size_t next = 1;
+    for (size_t i = 0; i < n; i++) {
+      for (uint32_t c : {lefts[i], rights[i]})
+        if (c != FlatTree::npos && c != next++)
+          binaryError("child indices are not in BFS order");
+    }
+    if (n > 0 && next != n)
+      binaryError("child indices are not in BFS order");
+  }
+
+  // Nulls are only counted, and written once a later value proves they are
+  // not trailing, so nothing has to be trimmed afterwards
+  template <typename T>
+  static void writeLevelOrder(BasicTreeNode<T> *root, OutputSink &sink) {
+    TREE_PROFILE_SCOPE("Codec::serialize");
+    TREE_PROFILE_OUTPUT(sink);
+    if (!root) {
+      sink.write("[]");
+      return;
+    }
+
+    char buf[TreeValue<T>::kMaxWidth];
+    sink.put('[');
+    sink.write(TreeValue<T>::format(root->val, buf));
+
+    // Each level's child slots, left to right, are the next tokens
+    size_t pendingNulls = 0;
+    auto slot = [&](BasicTreeNode<T> *child) {
+      if (!child) {
+        pendingNulls++;
+        return;
+      }
+      for (; pendingNulls > 0; pendingNulls--)
+        sink.write(",null");
+      sink.put(',');
+      sink.write(TreeValue<T>::format(child->val, buf));
+    };
+    forEachTreeLevel(root, [&](const auto &level, int) {
+      for (BasicTreeNode<T> *node : level) {
+        slot(node->left);
+        slot(node->right);
+      }
+      TREE_PROFILE_NODES(level.size());
+      return true;
+    });
+
+    sink.put(']');
+  }
+
+  // A single comma-separated token, with '[', ']' and ' ' already dropped
+  struct Token {
+    std::string_view text;
+    size_t offset = 0;
+  };
+
+  // Splits the input into tokens in one pass without copying it. Brackets
+  // and spaces are ignored wherever they appear and a trailing empty token
+  // is dropped, exactly like the old strip-then-getline approach.
+  class TokenScanner {
+  public:
+    explicit TokenScanner(std::string_view data) : data(data) {}
+
+    bool next(Token &tok) {
+      if (done)
+        return false;
+
+      size_t first = std::string_view::npos, last = 0, kept = 0;
+      size_t i = pos;
+      for (; i < data.size() && data[i] != ','; i++) {
+        char c = data[i];
+        if (c == '[' || c == ']' || c == ' ')
+          continue;
+        if (first == std::string_view::npos)
+          first = i;
+        last = i;
+        kept++;
+      }
+
+      bool atEnd = i == data.size();
+      size_t start = pos;
+      pos = i + 1;
+      if (atEnd) {
+        done = true;
+        if (kept == 0)
+          return false;
+      }
+
+      if (kept == 0) {
+        tok.text = std::string_view();
+        tok.offset = start;
+      } else if (last - first + 1 == kept) {
+        tok.text = data.substr(first, kept);
+        tok.offset = first;
+      } else {
+        // Brackets or spaces inside a token, e.g. "1 2": stitch it together
+        scratch.clear();
+        for (size_t j = first; j <= last; j++) {
+          char c = data[j];
+          if (c != '[' && c != ']' && c != ' ')
+            scratch.push_back(c);
+        }
+        tok.text = scratch;
+        tok.offset = first;
+      }
+      return true;
+    }
+
+  private:
+    std::string_view data;
+    size_t pos = 0;
+    bool done = false;
+    std::string scratch;
+  };
+
+  // Parse a value the way std::stoi / std::stod do (leading whitespace,
+  // optional sign, trailing characters ignored). In strict mode the token
+  // must be a number and nothing else.
+  template <typename T>
+  static bool parseValue(const Token &tok, bool strict, T &out,
+                         ParseStatus &status) {
+    const char *p = tok.text.data();
+    const char *end = p + tok.text.size();
+    if (!strict)
+      while (p < end && std::isspace(static_cast<unsigned char>(*p)))
+        p++;
+    if (p < end && *p == '+') {
+      p++;
+      if (p == end || !std::isdigit(static_cast<unsigned char>(*p)))
+        return fail(tok, ParseStatus::InvalidValue, status);
+    }
+
+    auto [next, ec] = std::from_chars(p, end, out);
+    if (ec == std::errc::result_out_of_range)
+      return fail(tok, ParseStatus::OutOfRange, status);
+    if (ec != std::errc() || (strict && next != end))
+      return fail(tok, ParseStatus::InvalidValue, status);
+    return true;
+  }
+
+  static bool fail(const Token &tok, ParseStatus::Error error,
+                   ParseStatus &status) {
+    status.ok = false;
+    status.error = error;
+    status.offset = tok.offset;
+    status.message = error == ParseStatus::OutOfRange ? "value out of range"
+                                                      : "invalid value";
+    return false;
+  }
+
+  static bool isNull(const Token &tok) { return tok.text == "null"; }
+
+  [[noreturn]] static void throwError(const ParseStatus &status) {
+    std::string what = "Codec::deserialize: " + status.message +
+                       " at offset " + std::to_string(status.offset);
+    if (status.error == ParseStatus::OutOfRange)
+      throw std::out_of_range(what);
+    throw std::invalid_argument(what);
+  }
+
+  template <typename T> struct NewNode {
+    using Value = T;
+    BasicTreeNode<T> *operator()(T val) const {
+      return new BasicTreeNode<T>(val);
+    }
+  };
+
+  template <typename T> struct ArenaNode {
+    using Value = T;
+    BasicTreeArena<T> &arena;
+    BasicTreeNode<T> *operator()(T val) const { return arena.create(val); }
+  };
+
+  // Parse targets: add() creates a node, link() hangs it under its parent
+  template <typename MakeNode> struct NodeBuilder {
+    using Value = typename MakeNode::Value;
+    using Handle = BasicTreeNode<Value> *;
+
+    MakeNode makeNode;
+    Handle root = nullptr;
+
+    Handle add(Value val) {
+      Handle node = makeNode(val);
+      if (!root)
+        root = node;
+      return node;
+    }
+    void linkLeft(Handle parent, Handle child) { parent->left = child; }
+    void linkRight(Handle parent, Handle child) { parent->right = child; }
+  };
+
+  struct FlatBuilder {
+    using Value = int;
+    using Handle = uint32_t;
+
+    FlatTree &tree;
+
+    Handle add(int val) { return tree.addNode(val); }
+    void linkLeft(Handle parent, Handle child) { tree.setLeft(parent, child); }
+    void linkRight(Handle parent, Handle child) {
+      tree.setRight(parent, child);
+    }
+  };
+
+  // Read tokens and attach children level by level as they arrive. On
+  // error the builder keeps the partial tree and the caller disposes of it.
+  template <typename Builder>
+  static void parse(std::string_view data, ParseStatus &status, bool strict,
+                    Builder &builder) {
+    TREE_PROFILE_SCOPE("Codec::deserialize");
+    TREE_PROFILE_BYTES_IN(data.size());
+    using Handle = typename Builder::Handle;
+    TokenScanner scanner(data);
+    Token tok;
+    typename Builder::Value val;
+
+    if (!scanner.next(tok) || isNull(tok))
+      return;
+    if (!parseValue(tok, strict, val, status))
+      return;
+
+    LevelFrontier<Handle> frontier(builder.add(val));
+    TREE_PROFILE_NODES(1);
+
+    do {
+      for (Handle node : frontier.level()) {
+        // Left child
+        if (!scanner.next(tok))
+          return;
+        if (!isNull(tok)) {
+          if (!parseValue(tok, strict, val, status))
+            return;
+          Handle child = builder.add(val);
+          TREE_PROFILE_NODES(1);
+          builder.linkLeft(node, child);
+          frontier.push(child);
+        }
+
+        // Right child
+        if (!scanner.next(tok))
+          return;
+        if (!isNull(tok)) {
+          if (!parseValue(tok, strict, val, status))
+            return;
+          Handle child = builder.add(val);
+          TREE_PROFILE_NODES(1);
+          builder.linkRight(node, child);
+          frontier.push(child);
+        }
+      }
+    } while (frontier.advance());
+  }
+
+  // Free a partially built tree after a parse error
+  template <typename T>
+  static BasicTreeNode<T> *release(BasicTreeNode<T> *root) {
+    if (!root)
+      return nullptr;
+    std::vector<BasicTreeNode<T> *> stack = {root};
+    while (!stack.empty()) {
+      BasicTreeNode<T> *node = stack.back();
+      stack.pop_back();
+      if (node->left)
+        stack.push_back(node->left);
+      if (node->right)
+        stack.push_back(node->right);
+      delete node;
+    }
+    return nullptr;
+  }
+};
+
+// ============================================================================
+// Streaming Deserializer
+// ============================================================================
+
+// Codec::deserialize for input that arrives in pieces, such as blocks read
+// from a file, pipe or socket. A token may be split anywhere between two
+// feed() calls. Only the unfinished token and the BFS frontier are kept,
+// so the extra memory is bounded by the widest level, not the input size.
+// Offsets count from the first byte fed. Parsing is strict by default, as
+// in deserialize(data, status). After an error the partial tree stays in
+// the target.
+//
+//   FlatTree tree;
+//   Codec::FlatStream parser(tree);
+//   while (readSomeInto(block))
+//     parser.feed(block);
+//   if (!parser.finish())
+//     report(parser.status());
+template <typename Builder> class Codec::StreamParser {
+public:
+  using Value = typename Builder::Value;
+  using Handle = typename Builder::Handle;
+
+  // Nodes are added to the arena; take the tree from root()
+  template <typename T>
+  explicit StreamParser(BasicTreeArena<T> &arena, bool strict = true)
+      : builder{ArenaNode<T>{arena}, nullptr}, strict(strict) {}
+
+  // The tree is cleared first and filled in place
+  explicit StreamParser(FlatTree &tree, bool strict = true)
+      : builder{tree}, strict(strict) {
+    tree.clear();
+  }
+
+  // Parse the next piece of input. Returns false once parsing has failed.
+  // Anything fed after an error, or after the tree is complete, is ignored.
+  bool feed(std::string_view data) {
+    TREE_PROFILE_SCOPE("Codec::StreamParser");
+    TREE_PROFILE_BYTES_IN(data.size());
+    for (size_t i = 0; i < data.size() && !done;) {
+      size_t comma = std::min(data.find(',', i), data.size());
+      append(data.substr(i, comma - i), consumed + i);
+      if (comma == data.size())
+        break;
+      emit();
+      i = comma + 1;
+      segmentStart = consumed + i;
+    }
+    consumed += data.size();
+    return parseStatus.ok;
+  }
+
+  // Feed the rest of in, stopping early once the tree is complete
+  bool feed(std::istream &in) {
+    std::vector<char> block(kReadBlock);
+    while (!done && in) {
+      in.read(block.data(), static_cast<std::streamsize>(block.size()));
+      feed(std::string_view(block.data(), static_cast<size_t>(in.gcount())));
+    }
+    return parseStatus.ok;
+  }
+
+  // End of input: the last token needs no comma after it
+  bool finish() {
+    if (!done && kept)
+      emit();
+    done = true;
+    return parseStatus.ok;
+  }
+
+  // True once no more input can change the tree
+  bool complete() const { return done; }
+
+  const ParseStatus &status() const { return parseStatus; }
+
+  // Root of an arena tree, nullptr while empty or after an error
+  BasicTreeNode<Value> *root() const {
+    return parseStatus.ok ? builder.root : nullptr;
+  }
+
+private:
+  static constexpr size_t kReadBlock = size_t(1) << 16;
+
+  // Keep the characters of the current token, minus brackets and spaces
+  void append(std::string_view piece, size_t offset) {
+    for (size_t j = 0; j < piece.size(); j++) {
+      char c = piece[j];
+      if (c == '[' || c == ']' || c == ' ')
+        continue;
+      if (!kept)
+        tokenOffset = offset + j;
+      kept = true;
+      text.push_back(c);
+    }
+  }
+
+  void emit() {
+    accept(Token{text, kept ? tokenOffset : segmentStart});
+    text.clear();
+    kept = false;
+  }
+
+  // One step of Codec::parse: the root, then alternately the left and
+  // right child of each node in the current frontier level
+  void accept(const Token &tok) {
+    Value val{};
+    if (!started) {
+      started = true;
+      if (isNull(tok) || !parseValue(tok, strict, val, parseStatus)) {
+        done = true;
+        return;
+      }
+      frontier.emplace(builder.add(val));
+      return;
+    }
+
+    Handle parent = frontier->level()[cursor];
+    if (!isNull(tok)) {
+      if (!parseValue(tok, strict, val, parseStatus)) {
+        done = true;
+        return;
+      }
+      Handle child = builder.add(val);
+      if (rightNext)
+        builder.linkRight(parent, child);
+      else
+        builder.linkLeft(parent, child);
+      frontier->push(child);
+    }
+    rightNext = !rightNext;
+    if (!rightNext && ++cursor == frontier->level().size()) {
+      cursor = 0;
+      done = !frontier->advance();
+    }
+  }
+
+  Builder builder;
+  bool strict;
+  ParseStatus parseStatus;
+  std::optional<LevelFrontier<Handle>> frontier; // Set by the root token
+  size_t cursor = 0;       // Parent of the next token in the level
+  std::string text;        // Current token so far
+  bool kept = false;       // text holds at least one character
+  size_t tokenOffset = 0;  // Offset of its first character
+  size_t segmentStart = 0; // Offset just past the last comma
+  size_t consumed = 0;     // Bytes fed so far
+  bool started = false;    // The root token has been read
+  bool rightNext = false;  // Next token is a right child
+  bool done = false;
+};
+
+// ============================================================================
+// Memory-Mapped Trees
+// ============================================================================
+
+// Maps a Codec::serializeBinary file and exposes it as a read-only
+// FlatTree. Images written with childIndex (and without deltaVarint) are
+// used in place on little-endian hosts; anything else is decoded once.
+class MappedTree {
+public:
+  explicit MappedTree(const std::string &path, bool verify = true) {
+    map(path);
+    try {
+      open(verify);
+    } catch (...) {
+      unmap();
+      throw;
+    }
+  }
+
+  ~MappedTree() { unmap(); }
+
+  MappedTree(const MappedTree &) = delete;
+  MappedTree &operator=(const MappedTree &) = delete;
+
+  const FlatTree &tree() const { return flat; }
+
+  // True when no per-node work was needed to open the file
+  bool isZeroCopy() const { return zeroCopy; }
+
+private:
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  static constexpr bool kLittleEndian = true;
+#else
+  static constexpr bool kLittleEndian = false;
+#endif
+
+  void open(bool verify) {
+    std::string_view bytes(static_cast<const char *>(base), length);
+    Codec::BinaryLayout layout = Codec::readLayout(bytes);
+    size_t n = layout.count;
+
+    bool plainValues = !(layout.flags & Codec::kDeltaVarint);
+    bool storedChildren = layout.flags & Codec::kChildIndex;
+    if (kLittleEndian && plainValues && storedChildren) {
+      auto lefts = reinterpret_cast<const uint32_t *>(layout.lefts);
+      auto rights = reinterpret_cast<const uint32_t *>(layout.rights);
+      if (verify)
+        Codec::verifyChildren(lefts, rights, n);
+      flat = FlatTree::view(reinterpret_cast<const int *>(layout.values),
+                            lefts, rights, n);
+      zeroCopy = true;
+      return;
+    }
+
+    Codec::decodeChildren(layout, lefts, rights);
+    const int *values;
+    if (kLittleEndian && plainValues) {
+      values = reinterpret_cast<const int *>(layout.values);
+    } else {
+      Codec::decodeValues(layout, decoded);
+      values = decoded.data();
+    }
+    flat = FlatTree::view(values, lefts.data(), rights.data(), n);
+  }
+
+#if defined(__unix__) || defined(__APPLE__)
+  void map(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error("MappedTree: cannot open " + path);
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw std::runtime_error("MappedTree: cannot stat " + path);
+    }
+    length = static_cast<size_t>(st.st_size);
+    if (length > 0) {
+      base = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (base == MAP_FAILED) {
+        base = nullptr;
+        ::close(fd);
+        throw std::runtime_error("MappedTree: cannot map " + path);
+      }
+    }
+    ::close(fd);
+  }
+
+  void unmap() {
+    if (base)
+      ::munmap(base, length);
+  }
+#else
+  // No mmap: read the whole file into memory instead
+  void map(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+      throw std::runtime_error("MappedTree: cannot open " + path);
+    buffer.assign(std::istreambuf_iterator<char>(in),
+                  std::istreambuf_iterator<char>());
+    base = buffer.data();
+    length = buffer.size();
+  }
+
+  void unmap() {}
+
+  std::vector<char> buffer;
+#endif
+
+  void *base = nullptr;
+  size_t length = 0;
+  FlatTree flat;
+  std::vector<int> decoded;
+  std::vector<uint32_t> lefts, rights;
+  bool zeroCopy = false;
+};
+
+// ============================================================================
+// Stack-Safe Recursion
+// ============================================================================
+
+// Recursive helpers hand the subtree below this depth to an explicit-stack
+// engine, which finishes it in place, so a degenerate tree of any depth
+// runs in bounded native stack and nothing is redone.
+constexpr int kMaxRecursionDepth = 4096;
+
+// Per-thread stack reused by the explicit-stack engines, so repeated calls
+// don't allocate once it has grown to the deepest tree seen
+template <typename T> std::vector<T> &scratchStack() {
+  thread_local std::vector<T> stack;
+  stack.clear();
+  return stack;
+}
+
+// ============================================================================
+// Tree Visualizer
+// ============================================================================
+
+// Subtree sizes computed on first request and remembered, so collapsed
+// parts of a huge tree are only counted once. Clear it whenever the tree
+// changes.
+class SubtreeSizes {
+public:
+  // What the inorder layout needs to step over a subtree unseen
+  struct Extent {
+    size_t nodes;
+    size_t height;
+    size_t columns; // Label widths plus one gap per node
+  };
+
+  size_t of(TreeNode *root) { return extent(root).nodes; }
+
+  const Extent &extent(TreeNode *root) {
+    if (!root)
+      return kEmpty;
+    auto hit = memo.find(root);
+    if (hit != memo.end())
+      return hit->second;
+
+    // Post-order walk that stops at subtrees already counted
+    stack.clear();
+    stack.push_back({root, false});
+    while (!stack.empty()) {
+      auto [node, expanded] = stack.back();
+      if (!expanded) {
+        stack.back().second = true;
+        for (TreeNode *child : {node->left, node->right})
+          if (child && !memo.count(child))
+            stack.push_back({child, false});
+        continue;
+      }
+      stack.pop_back();
+      const Extent &left = known(node->left), &right = known(node->right);
+      char buf[16];
+      size_t label = std::to_chars(buf, buf + sizeof(buf), node->val).ptr -
+                     buf;
+      memo[node] = {1 + left.nodes + right.nodes,
+                    1 + std::max(left.height, right.height),
+                    label + 1 + left.columns + right.columns};
+    }
+    return memo[root];
+  }
+
+  void clear() { memo.clear(); }
+  size_t cached() const { return memo.size(); }
+
+private:
+  const Extent &known(TreeNode *node) const {
+    return node ? memo.at(node) : kEmpty;
+  }
+
+  static inline const Extent kEmpty{};
+
+  std::unordered_map<const TreeNode *, Extent> memo;
+  std::vector<std::pair<TreeNode *, bool>> stack;
+};
+
+// Which part of a tree TreeVisualizer::printViewport draws
+struct TreeViewport {
+  TreeNode *node = nullptr; // Start here, or else follow path from the root
+  std::string path;         // Steps from the root, 'L' or 'R' each
+  int depth = -1;           // Levels to draw below the start, -1 = all
+  size_t firstRow = 0;      // Rows and columns of the drawing to keep
+  size_t lastRow = SIZE_MAX;
+  size_t firstColumn = 0;
+  size_t lastColumn = SIZE_MAX;
+  SubtreeSizes *sizes = nullptr; // Reused across calls when set
+};
+
+class TreeVisualizer {
+private:
+  // Where the classic renderers put each node: level d has slots[d] cells,
+  // two under every real node of level d - 1, and only real nodes are
+  // stored, with their cell index. Memory is O(n) however sparse the tree.
+  struct Grid {
+    int height = 0;
+    int maxWidth = 1;                // Widest value label
+    std::vector<TreeNode *> nodes;   // Real nodes, level by level
+    std::vector<uint32_t> slot;      // Cell of each node within its level
+    std::vector<size_t> levelStart;  // Level d is [levelStart[d], [d + 1])
+    std::vector<size_t> slots;       // Cells on each level
+    bool mirrored = false;           // Children are read through a mirror
+
+    TreeNode *left(TreeNode *node) const {
+      return mirrored ? node->right : node->left;
+    }
+    TreeNode *right(TreeNode *node) const {
+      return mirrored ? node->left : node->right;
+    }
+  };
+
+  // One breadth-first pass for height, label width and node positions
+  static Grid buildGrid(TreeView root) {
+    Grid grid;
+    if (!root)
+      return grid;
+    grid.mirrored = root.mirrored();
+    grid.nodes.push_back(root.node());
+    grid.slot.push_back(0);
+    grid.slots.push_back(1);
+
+    for (size_t begin = 0; begin < grid.nodes.size(); grid.height++) {
+      size_t end = grid.nodes.size();
+      grid.levelStart.push_back(begin);
+      for (size_t i = begin; i < end; i++) {
+        TreeNode *node = grid.nodes[i];
+        grid.maxWidth = std::max(grid.maxWidth, valueWidth(node->val));
+        uint32_t cell = static_cast<uint32_t>(2 * (i - begin));
+        if (TreeNode *left = grid.left(node)) {
+          grid.nodes.push_back(left);
+          grid.slot.push_back(cell);
+        }
+        if (TreeNode *right = grid.right(node)) {
+          grid.nodes.push_back(right);
+          grid.slot.push_back(cell + 1);
+        }
+      }
+      grid.slots.push_back(2 * (end - begin));
+      begin = end;
+    }
+    grid.levelStart.push_back(grid.nodes.size());
+    return grid;
+  }
+
+  // Walk the cells of level d: real(node) for each node, gap(count) for
+  // each run of empty cells between and after them
+  template <typename Real, typename Gap>
+  static void forEachCell(const Grid &grid, int d, Real &&real, Gap &&gap) {
+    size_t cursor = 0;
+    for (size_t i = grid.levelStart[d]; i < grid.levelStart[d + 1]; i++) {
+      if (grid.slot[i] > cursor)
+        gap(grid.slot[i] - cursor);
+      real(grid.nodes[i]);
+      cursor = grid.slot[i] + 1;
+    }
+    if (grid.slots[d] > cursor)
+      gap(grid.slots[d] - cursor);
+  }
+
+  static int valueWidth(int val) {
+    char buf[16];
+    return static_cast<int>(formatValue(val, buf).size());
+  }
+  // Write s centered within width (or as is when it does not fit)
+  static void putCentered(OutputSink &sink, std::string_view s, int width) {
+    if (static_cast<int>(s.length()) >= width) {
+      sink.write(s);
+      return;
+    }
+    int padding = width - s.length();
+    int leftPad = padding / 2;
+    sink.fill(' ', leftPad);
+    sink.write(s);
+    sink.fill(' ', padding - leftPad);
+  }
+
+  // Decimal form of val in a caller-provided buffer, no allocation
+  static std::string_view formatValue(int val, char (&buf)[16]) {
+    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), val);
+    (void)ec;
+    return std::string_view(buf, end - buf);
+  }
+
+  // Render into one buffer, then hand it to the stream in a single write
+  template <typename Render>
+  static void renderTo(std::ostream &out, Render &&render) {
+    thread_local std::string text;
+    text.clear();
+    {
+      OutputSink sink(text);
+      render(sink);
+    }
+    out.write(text.data(), static_cast<std::streamsize>(text.size()));
+    if (text.capacity() > kMaxRetainedBuffer)
+      std::string().swap(text);
+  }
+
+  // Render buffers above this size are released instead of kept per thread
+  static constexpr size_t kMaxRetainedBuffer = size_t(1) << 22;
+
+  // The classic renderers need 2^(height-1) cells on the bottom row; past
+  // this many columns they hand over to the inorder layout instead
+  static bool fitsClassic(int height, int cellWidth) {
+    return height <= kMaxClassicHeight &&
+           (size_t(1) << (height - 1)) * cellWidth * 2 <= kMaxClassicWidth;
+  }
+
+  static constexpr int kMaxClassicHeight = 24;
+
+  static void renderEmpty(OutputSink &sink) {
+    sink.write("\n┌─────────────────┐\n");
+    sink.write("│   Empty Tree    │\n");
+    sink.write("└─────────────────┘\n");
+  }
+
+  static void renderAscii(TreeView root, OutputSink &sink) {
+    TREE_PROFILE_SCOPE("TreeVisualizer::print");
+    TREE_PROFILE_OUTPUT(sink);
+    if (!root) {
+      renderEmpty(sink);
+      return;
+    }
+
+    Grid grid = buildGrid(root);
+    TREE_PROFILE_NODES(grid.nodes.size());
+    int height = grid.height;
+    int maxNodeWidth = std::max(3, grid.maxWidth + 2); // Min 3 for branches
+    if (!fitsClassic(height, maxNodeWidth)) {
+      renderLayout(root, sink, kMaxClassicWidth);
+      return;
+    }
+
+    // Calculate width needed for bottom level
+    int bottomLevelNodes = 1 << (height - 1); // 2^(height-1)
+    int totalWidth = bottomLevelNodes * maxNodeWidth * 2;
+    char buf[16];
+
+    sink.put('\n');
+    sink.fill('=', totalWidth + 4);
+    sink.put('\n');
+
+    for (int levelIdx = 0; levelIdx < height; levelIdx++) {
+      int spacing = totalWidth / static_cast<int>(grid.slots[levelIdx]);
+
+      // Print node values; an empty cell is all blanks
+      sink.write("  ");
+      forEachCell(
+          grid, levelIdx,
+          [&](TreeNode *node) {
+            putCentered(sink, formatValue(node->val, buf), spacing);
+          },
+          [&](size_t count) { sink.fill(' ', count * spacing); });
+      sink.put('\n');
+
+      // Print branches (if not last level)
+      if (levelIdx < height - 1) {
+        int branchSpacing = spacing / 2;
+        int branchWidth = std::max(1, branchSpacing / 2);
+
+        // Draw multiple lines of branches for better visual
+        for (int line = 0; line < std::max(1, branchWidth / 2); line++) {
+          // Position branches
+          int leftPad = spacing / 2 - line - 2;
+          int midPad = line * 2 + 2;
+          int rightPad = spacing - leftPad - midPad - 2;
+
+          if (leftPad < 0)
+            leftPad = 0;
+          if (rightPad < 0)
+            rightPad = 0;
+
+          size_t cellWidth = leftPad + midPad + rightPad + 2;
+          sink.write("  ");
+          forEachCell(
+              grid, levelIdx,
+              [&](TreeNode *node) {
+                sink.fill(' ', leftPad);
+                sink.put(grid.left(node) ? '/' : ' ');
+                sink.fill(' ', midPad);
+                sink.put(grid.right(node) ? '\\' : ' ');
+                sink.fill(' ', rightPad);
+              },
+              [&](size_t count) { sink.fill(' ', count * cellWidth); });
+          sink.put('\n');
+        }
+      }
+    }
+
+    sink.fill('=', totalWidth + 4);
+    sink.put('\n');
+  }
+
+  static void renderBoxed(TreeView root, OutputSink &sink) {
+    TREE_PROFILE_SCOPE("TreeVisualizer::printBoxed");
+    TREE_PROFILE_OUTPUT(sink);
+    if (!root) {
+      sink.write("\n[Empty Tree]\n");
+      return;
+    }
+
+    Grid grid = buildGrid(root);
+    TREE_PROFILE_NODES(grid.nodes.size());
+    int height = grid.height;
+    int maxW = grid.maxWidth;
+    if (!fitsClassic(height, maxW + 2)) {
+      renderLayout(root, sink, kMaxClassicWidth);
+      return;
+    }
+
+    // Calculate spacing
+    int bottomNodes = 1 << (height - 1);
+    int cellWidth = maxW + 2;
+    int totalWidth = bottomNodes * cellWidth * 2;
+    char buf[16];
+
+    sink.put('\n');
+    sink.fill('-', totalWidth);
+    sink.put('\n');
+
+    for (int lvl = 0; lvl < height; lvl++) {
+      int spacing = totalWidth / static_cast<int>(grid.slots[lvl]);
+
+      // Print values
+      forEachCell(
+          grid, lvl,
+          [&](TreeNode *node) {
+            putCentered(sink, formatValue(node->val, buf), spacing);
+          },
+          [&](size_t count) {
+            while (count--)
+              putCentered(sink, "·", spacing);
+          });
+      sink.put('\n');
+
+      // Print connectors
+      if (lvl < height - 1) {
+        forEachCell(
+            grid, lvl,
+            [&](TreeNode *node) {
+              std::string_view conn = "   ";
+              if (grid.left(node) && grid.right(node))
+                conn = "|+|";
+              else if (grid.left(node))
+                conn = "/  ";
+              else if (grid.right(node))
+                conn = "  \\";
+              putCentered(sink, conn, spacing);
+            },
+            [&](size_t count) { sink.fill(' ', count * spacing); });
+        sink.put('\n');
+      }
+    }
+
+    sink.fill('-', totalWidth);
+    sink.put('\n');
+  }
+
+  // Inorder layout: each node gets its own column range in inorder, as
+  // wide as its label plus a gap, so the drawing is as wide as the labels
+  // laid side by side. Rows are the BFS levels of a FlatTree, whose nodes
+  // are already ordered left to right.
+  struct Layout {
+    FlatTree tree;
+    std::vector<size_t> hidden;     // Per node: 0, or nodes it collapses
+    std::vector<size_t> column;     // Left edge of each label
+    std::vector<uint32_t> label;    // Label width in characters
+    std::vector<size_t> levelStart; // Level d is [levelStart[d], [d + 1])
+    size_t width = 0;
+
+    size_t center(uint32_t i) const { return column[i] + (label[i] - 1) / 2; }
+    bool isMarker(uint32_t i) const { return !hidden.empty() && hidden[i]; }
+  };
+
+  // Marker count of a subtree outside a viewport's columns, never drawn
+  static constexpr size_t kUncounted = SIZE_MAX;
+
+  // "…(n nodes)" stands in for a subtree left out of a viewport, and a
+  // bare "…" for one that was not counted
+  static std::string_view formatMarker(size_t count, char (&buf)[32]) {
+    if (count == kUncounted)
+      return std::string_view(std::copy_n("…", 3, buf) - 3, 3);
+    char *p = std::copy_n("…(", 4, buf);
+    p = std::to_chars(p, buf + sizeof(buf), count).ptr;
+    std::string_view unit = count == 1 ? " node)" : " nodes)";
+    p = std::copy(unit.begin(), unit.end(), p);
+    return std::string_view(buf, p - buf);
+  }
+
+  template <typename Sink>
+  static void writeLabel(const Layout &layout, uint32_t i, Sink &sink) {
+    if (layout.isMarker(i)) {
+      char buf[32];
+      sink.write(formatMarker(layout.hidden[i], buf));
+    } else {
+      char buf[16];
+      sink.write(formatValue(layout.tree.value(i), buf));
+    }
+  }
+
+  static Layout buildLayout(TreeView root) {
+    Layout layout;
+    layout.tree = FlatTree::fromTree(root);
+    placeLayout(layout);
+    return layout;
+  }
+
+  // Lay out the part below start that a viewport can show. Levels deeper
+  // than depth are cut, and each subtree hanging off the cut becomes a
+  // marker. Columns are those of the whole cut drawing, yet a subtree
+  // wholly outside columns [first, last] is stepped over instead of laid
+  // out: one starting past last becomes an uncounted "…", and one ending
+  // before first, if the cut does not reach it, becomes a "…" at the end
+  // of its span, which sizes supplies. So the nodes visited are those near
+  // the window, plus those left of it in subtrees that reach the cut.
+  static Layout buildLayout(TreeView start, size_t depth, size_t first,
+                            size_t last, SubtreeSizes &sizes) {
+    constexpr uint32_t npos = FlatTree::npos;
+    struct Item {
+      TreeView node;
+      size_t level, column, hidden;
+      uint32_t label, parent;
+      bool isLeft;
+    };
+    // self is the node's item once its left subtree is under way
+    struct Frame {
+      TreeView node;
+      size_t level;
+      uint32_t parent, self;
+      bool isLeft;
+    };
+    std::vector<Item> items;
+    std::vector<Frame> stack;
+    if (start && depth > 0)
+      stack.push_back({start, 0, npos, npos, false});
+
+    // Inorder walk; x is the next free column
+    size_t x = 0;
+    char buf[32];
+    auto place = [&](const Frame &f, size_t column, size_t hidden,
+                     uint32_t label) {
+      items.push_back(
+          {f.node, f.level, column, hidden, label, f.parent, f.isLeft});
+      return static_cast<uint32_t>(items.size() - 1);
+    };
+    while (!stack.empty()) {
+      Frame f = stack.back();
+      stack.pop_back();
+      if (f.self != npos) {
+        Item &item = items[f.self];
+        item.column = x;
+        x += item.label + 1;
+        if (TreeView right = f.node.right())
+          stack.push_back({right, f.level + 1, f.self, npos, false});
+        continue;
+      }
+      if (x > last) {
+        place(f, x, kUncounted, 1);
+        x += 2;
+        continue;
+      }
+      if (f.level == depth) {
+        size_t count = sizes.of(f.node.node());
+        auto label = static_cast<uint32_t>(formatMarker(count, buf).size() - 2);
+        place(f, x, count, label);
+        x += label + 1;
+        continue;
+      }
+      if (x < first) {
+        const SubtreeSizes::Extent &extent = sizes.extent(f.node.node());
+        if (f.level + extent.height <= depth && x + extent.columns <= first) {
+          place(f, x + extent.columns - 2, kUncounted, 1);
+          x += extent.columns;
+          continue;
+        }
+      }
+      uint32_t self = place(f, 0, 0, valueWidth(f.node.val()));
+      stack.push_back({f.node, f.level, f.parent, self, f.isLeft});
+      if (TreeView left = f.node.left())
+        stack.push_back({left, f.level + 1, self, npos, true});
+    }
+
+    // Level by level, left to right, is the order the rows are drawn in
+    std::vector<uint32_t> order(items.size());
+    for (uint32_t i = 0; i < order.size(); i++)
+      order[i] = i;
+    std::sort(order.begin(), order.end(), [&items](uint32_t a, uint32_t b) {
+      return items[a].level != items[b].level
+                 ? items[a].level < items[b].level
+                 : items[a].column < items[b].column;
+    });
+    std::vector<uint32_t> index(items.size());
+    for (uint32_t i = 0; i < order.size(); i++)
+      index[order[i]] = i;
+
+    Layout layout;
+    FlatTree &tree = layout.tree;
+    for (uint32_t i : order) {
+      const Item &item = items[i];
+      tree.addNode(item.node.val());
+      layout.hidden.push_back(item.hidden);
+      layout.column.push_back(item.column);
+      layout.label.push_back(item.label);
+      if (layout.levelStart.size() <= item.level)
+        layout.levelStart.push_back(tree.size() - 1);
+    }
+    layout.levelStart.push_back(tree.size());
+    for (uint32_t i = 0; i < items.size(); i++) {
+      if (items[i].parent == npos)
+        continue;
+      if (items[i].isLeft)
+        tree.setLeft(index[items[i].parent], index[i]);
+      else
+        tree.setRight(index[items[i].parent], index[i]);
+    }
+    layout.width = x ? x - 1 : 0;
+    return layout;
+  }
+
+  // Label widths, inorder columns and level boundaries of a built tree
+  static void placeLayout(Layout &layout) {
+    const FlatTree &tree = layout.tree;
+    size_t n = tree.size();
+    layout.column.resize(n);
+    layout.label.resize(n);
+    char buf[32];
+    for (size_t i = 0; i < n; i++)
+      layout.label[i] =
+          layout.isMarker(i)
+              ? static_cast<uint32_t>(
+                    formatMarker(layout.hidden[i], buf).size() - 2)
+              : valueWidth(tree.value(i));
+
+    // Columns: running label width along an explicit-stack inorder walk
+    auto &stack = scratchStack<uint32_t>();
+    uint32_t node = n ? 0 : FlatTree::npos;
+    size_t x = 0;
+    while (node != FlatTree::npos || !stack.empty()) {
+      for (; node != FlatTree::npos; node = tree.left(node))
+        stack.push_back(node);
+      node = stack.back();
+      stack.pop_back();
+      layout.column[node] = x;
+      x += layout.label[node] + 1;
+      node = tree.right(node);
+    }
+    layout.width = x ? x - 1 : 0;
+
+    size_t begin = 0, end = n ? 1 : 0;
+    while (begin < end) {
+      layout.levelStart.push_back(begin);
+      size_t children = 0;
+      for (size_t i = begin; i < end; i++)
+        children += (tree.left(i) != FlatTree::npos) +
+                    (tree.right(i) != FlatTree::npos);
+      begin = end;
+      end += children;
+    }
+    layout.levelStart.push_back(n);
+  }
+
+  // Row of labels joined to their children's columns by underscores
+  template <typename Sink>
+  static void renderLayoutLabels(const Layout &layout, size_t begin,
+                                 size_t end, Sink &sink,
+                                 std::string_view indent = "  ") {
+    const FlatTree &tree = layout.tree;
+    size_t cursor = 0;
+    sink.write(indent);
+    for (size_t i = begin; i < end; i++) {
+      uint32_t left = tree.left(i), right = tree.right(i);
+      size_t start = left != FlatTree::npos ? layout.center(left) + 1
+                                            : layout.column[i];
+      sink.fill(' ', start - cursor);
+      sink.fill('_', layout.column[i] - start);
+      writeLabel(layout, i, sink);
+      cursor = layout.column[i] + layout.label[i];
+      if (right != FlatTree::npos) {
+        sink.fill('_', layout.center(right) - cursor);
+        cursor = layout.center(right);
+      }
+    }
+    sink.put('\n');
+  }
+
+  // Row of '/' and '\' right above each child's label
+  template <typename Sink>
+  static void renderLayoutBranches(const Layout &layout, size_t begin,
+                                   size_t end, Sink &sink,
+                                   std::string_view indent = "  ") {
+    const FlatTree &tree = layout.tree;
+    size_t cursor = 0;
+    sink.write(indent);
+    for (size_t i = begin; i < end; i++) {
+      for (uint32_t child : {tree.left(i), tree.right(i)}) {
+        if (child == FlatTree::npos)
+          continue;
+        size_t col = layout.center(child);
+        sink.fill(' ', col - cursor);
+        sink.put(child == tree.left(i) ? '/' : '\\');
+        cursor = col + 1;
+      }
+    }
+    sink.put('\n');
+  }
+
+  // maxWidth of 0 means no limit; wider layouts become the compact view
+  static void renderLayout(TreeView root, OutputSink &sink,
+                           size_t maxWidth) {
+    TREE_PROFILE_SCOPE("TreeVisualizer::printLayout");
+    TREE_PROFILE_OUTPUT(sink);
+    if (!root) {
+      renderEmpty(sink);
+      return;
+    }
+    Layout layout = buildLayout(root);
+    TREE_PROFILE_NODES(layout.tree.size());
+    if (maxWidth && layout.width + 4 > maxWidth) {
+      renderCompact(root, sink, "", true);
+      return;
+    }
+
+    sink.put('\n');
+    sink.fill('=', layout.width + 4);
+    sink.put('\n');
+    size_t levels = layout.levelStart.size() - 1;
+    for (size_t d = 0; d < levels; d++) {
+      size_t begin = layout.levelStart[d], end = layout.levelStart[d + 1];
+      renderLayoutLabels(layout, begin, end, sink);
+      if (d + 1 < levels)
+        renderLayoutBranches(layout, begin, end, sink);
+    }
+    sink.fill('=', layout.width + 4);
+    sink.put('\n');
+  }
+
+  // Follow an L/R path from the root; nullptr if it leaves the tree
+  static TreeView walkPath(TreeView root, std::string_view path) {
+    for (char step : path) {
+      if (!root)
+        break;
+      if (step == 'L' || step == 'l')
+        root = root.left();
+      else if (step == 'R' || step == 'r')
+        root = root.right();
+      else
+        throw std::invalid_argument("TreeViewport: path steps are L or R");
+    }
+    return root;
+  }
+
+  // Passes columns [first, last] of each row on to sink and drops the
+  // rest as it is written. Columns count characters, so multi-byte UTF-8
+  // sequences stay whole.
+  class ColumnWindow {
+  public:
+    ColumnWindow(OutputSink &sink, size_t first, size_t last)
+        : sink(sink), first(first), last(last) {}
+
+    void write(std::string_view text) {
+      for (char c : text) {
+        if (c == '\n') {
+          sink.put('\n');
+          column = 0;
+          continue;
+        }
+        if ((static_cast<unsigned char>(c) & 0xc0) != 0x80)
+          column++;
+        if (column > first && column - 1 <= last)
+          sink.put(c);
+      }
+    }
+
+    void put(char c) { write(std::string_view(&c, 1)); }
+
+    void fill(char c, size_t n) {
+      size_t from = std::max(column, first);
+      size_t to = std::min(column + n, last == SIZE_MAX ? last : last + 1);
+      if (from < to)
+        sink.fill(c, to - from);
+      column += n;
+    }
+
+  private:
+    OutputSink &sink;
+    size_t first, last;
+    size_t column = 0; // Characters so far in this row
+  };
+
+  static void renderViewport(TreeView root, const TreeViewport &view,
+                             OutputSink &sink) {
+    TREE_PROFILE_SCOPE("TreeVisualizer::printViewport");
+    TREE_PROFILE_OUTPUT(sink);
+    TreeView start = view.node ? TreeView(view.node, root.mirrored())
+                               : walkPath(root, view.path);
+    if (!start) {
+      renderEmpty(sink);
+      return;
+    }
+
+    // Rows alternate labels and branches, so rows past lastRow need no
+    // levels below (lastRow / 2) + 1
+    size_t depth = view.depth < 0 ? SIZE_MAX : std::max<size_t>(view.depth, 1);
+    if (view.lastRow != SIZE_MAX)
+      depth = std::min(depth, view.lastRow / 2 + 1);
+
+    SubtreeSizes localSizes;
+    SubtreeSizes &sizes = view.sizes ? *view.sizes : localSizes;
+    Layout layout =
+        buildLayout(start, depth, view.firstColumn, view.lastColumn, sizes);
+    TREE_PROFILE_NODES(layout.tree.size());
+
+    ColumnWindow window(sink, view.firstColumn, view.lastColumn);
+    size_t levels = layout.levelStart.size() - 1;
+    size_t row = 0;
+    for (size_t d = 0; d < levels && row <= view.lastRow; d++) {
+      size_t begin = layout.levelStart[d], end = layout.levelStart[d + 1];
+      for (int part = 0; part < 2 && row <= view.lastRow; part++, row++) {
+        if (part == 1 && d + 1 == levels)
+          break;
+        if (row < view.firstRow)
+          continue;
+        if (part == 0)
+          renderLayoutLabels(layout, begin, end, window, "");
+        else
+          renderLayoutBranches(layout, begin, end, window, "");
+      }
+    }
+  }
+
+  struct CompactFrame {
+    TreeNode *node;
+    size_t prefixLength; // Prefix bytes that belong to this node's line
+    bool isLeft;
+    bool expanded; // Right subtree already written
+  };
+
+  // Right subtree, node, left subtree, like a reverse inorder walk. All
+  // lines share one prefix buffer: each frame remembers how much of it is
+  // its own, and children append their segment past that point.
+  static void renderCompact(TreeView root, OutputSink &sink,
+                            const std::string &prefix, bool isLeft) {
+    TREE_PROFILE_SCOPE("TreeVisualizer::printCompact");
+    TREE_PROFILE_OUTPUT(sink);
+    if (!root)
+      return;
+
+    static constexpr std::string_view kBar = "│   ", kGap = "    ";
+    thread_local std::string line;
+    line.assign(prefix);
+    auto &frames = scratchStack<CompactFrame>();
+    frames.push_back({root.node(), prefix.size(), isLeft, false});
+    bool mirrored = root.mirrored();
+
+    char buf[16];
+    while (!frames.empty()) {
+      CompactFrame &frame = frames.back();
+      TreeNode *node = frame.node;
+      TreeNode *left = mirrored ? node->right : node->left;
+      TreeNode *right = mirrored ? node->left : node->right;
+      line.resize(frame.prefixLength);
+
+      if (!frame.expanded) {
+        frame.expanded = true;
+        if (right) {
+          line.append(frame.isLeft ? kBar : kGap);
+          frames.push_back({right, line.size(), false, false});
+        }
+        continue;
+      }
+
+      sink.write(line);
+      sink.write(frame.isLeft ? "└── " : "┌── ");
+      sink.write(formatValue(node->val, buf));
+      sink.put('\n');
+      TREE_PROFILE_NODES(1);
+
+      // The left child takes over this frame; nothing is left to do here
+      if (left) {
+        line.append(frame.isLeft ? kGap : kBar);
+        frame = {left, line.size(), true, false};
+      } else {
+        frames.pop_back();
+      }
+    }
+    if (line.capacity() > kMaxRetainedBuffer)
+      std::string().swap(line);
+  }
+
+  // ---- Structured exports --------------------------------------------------
+  // DOT, SVG and JSON all come from one inorder layout: x is a node's
+  // center column, y its level. Nodes go straight to the sink, so only the
+  // layout is held, never the document.
+
+  // SVG pixels per layout column, per level and per box, and the border
+  static constexpr int kSvgColumn = 10, kSvgRow = 48, kSvgBox = 24;
+  static constexpr int kSvgMargin = 20;
+
+  // visit(i, d) for every node, level by level, left to right
+  template <typename Visit>
+  static void forEachPlaced(const Layout &layout, Visit &&visit) {
+    for (size_t d = 0; d + 1 < layout.levelStart.size(); d++)
+      for (size_t i = layout.levelStart[d]; i < layout.levelStart[d + 1]; i++)
+        visit(static_cast<uint32_t>(i), d);
+  }
+
+  static void writeChildId(uint32_t child, OutputSink &sink) {
+    if (child == FlatTree::npos)
+      sink.write("null");
+    else
+      sink.writeInt(child);
+  }
+
+  static void renderDot(TreeView root, OutputSink &sink) {
+    TREE_PROFILE_SCOPE("TreeVisualizer::printDot");
+    TREE_PROFILE_OUTPUT(sink);
+    Layout layout = buildLayout(root);
+    TREE_PROFILE_NODES(layout.tree.size());
+    const FlatTree &tree = layout.tree;
+    long long levels = static_cast<long long>(layout.levelStart.size()) - 1;
+    char buf[16];
+
+    sink.write("digraph Tree {\n  node [shape=circle];\n");
+    forEachPlaced(layout, [&](uint32_t i, size_t d) {
+      sink.write("  n");
+      sink.writeInt(i);
+      sink.write(" [label=\"");
+      sink.write(formatValue(tree.value(i), buf));
+      sink.write("\", pos=\"");
+      sink.writeInt(static_cast<long long>(layout.center(i)) * kSvgColumn);
+      sink.put(',');
+      sink.writeInt((levels - 1 - static_cast<long long>(d)) * kSvgRow);
+      sink.write("!\"];\n");
+      for (uint32_t child : {tree.left(i), tree.right(i)}) {
+        if (child == FlatTree::npos)
+          continue;
+        sink.write("  n");
+        sink.writeInt(i);
+        sink.write(" -> n");
+        sink.writeInt(child);
+        sink.write(";\n");
+      }
+    });
+    sink.write("}\n");
+  }
+
+  static void renderSvg(TreeView root, OutputSink &sink) {
+    TREE_PROFILE_SCOPE("TreeVisualizer::printSvg");
+    TREE_PROFILE_OUTPUT(sink);
+    Layout layout = buildLayout(root);
+    TREE_PROFILE_NODES(layout.tree.size());
+    const FlatTree &tree = layout.tree;
+    size_t levels = layout.levelStart.size() - 1;
+    auto x = [&layout](uint32_t i) {
+      return kSvgMargin + static_cast<long long>(layout.column[i]) *
+                              kSvgColumn +
+             layout.label[i] * kSvgColumn / 2;
+    };
+    auto y = [](size_t d) {
+      return kSvgMargin + static_cast<long long>(d) * kSvgRow + kSvgBox / 2;
+    };
+    long long width =
+        2 * kSvgMargin + static_cast<long long>(layout.width) * kSvgColumn;
+    long long height = 2 * kSvgMargin;
+    if (levels)
+      height += static_cast<long long>(levels - 1) * kSvgRow + kSvgBox;
+    char buf[16];
+
+    sink.write("<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"");
+    sink.writeInt(width);
+    sink.write("\" height=\"");
+    sink.writeInt(height);
+    sink.write("\" font-family=\"monospace\" font-size=\"14\" "
+               "text-anchor=\"middle\" dominant-baseline=\"central\">\n");
+
+    // Edges first, so the boxes drawn after them cover their ends
+    sink.write("<g stroke=\"#555\">\n");
+    forEachPlaced(layout, [&](uint32_t i, size_t d) {
+      for (uint32_t child : {tree.left(i), tree.right(i)}) {
+        if (child == FlatTree::npos)
+          continue;
+        sink.write("<line x1=\"");
+        sink.writeInt(x(i));
+        sink.write("\" y1=\"");
+        sink.writeInt(y(d));
+        sink.write("\" x2=\"");
+        sink.writeInt(x(child));
+        sink.write("\" y2=\"");
+        sink.writeInt(y(d + 1));
+        sink.write("\"/>\n");
+      }
+    });
+    sink.write("</g>\n<g fill=\"#fff\" stroke=\"#333\">\n");
+    forEachPlaced(layout, [&](uint32_t i, size_t d) {
+      long long boxWidth = layout.label[i] * kSvgColumn + 4;
+      sink.write("<rect x=\"");
+      sink.writeInt(x(i) - boxWidth / 2);
+      sink.write("\" y=\"");
+      sink.writeInt(y(d) - kSvgBox / 2);
+      sink.write("\" width=\"");
+      sink.writeInt(boxWidth);
+      sink.write("\" height=\"");
+      sink.writeInt(kSvgBox);
+      sink.write("\" rx=\"4\"/>\n");
+    });
+    sink.write("</g>\n<g fill=\"#000\">\n");
+    forEachPlaced(layout, [&](uint32_t i, size_t d) {
+      sink.write("<text x=\"");
+      sink.writeInt(x(i));
+      sink.write("\" y=\"");
+      sink.writeInt(y(d));
+      sink.write("\">");
+      sink.write(formatValue(tree.value(i), buf));
+      sink.write("</text>\n");
+    });
+    sink.write("</g>\n</svg>\n");
+  }
+
+  static void renderJson(TreeView root, OutputSink &sink) {
+    TREE_PROFILE_SCOPE("TreeVisualizer::printJson");
+    TREE_PROFILE_OUTPUT(sink);
+    Layout layout = buildLayout(root);
+    TREE_PROFILE_NODES(layout.tree.size());
+    const FlatTree &tree = layout.tree;
+
+    sink.write("{\"width\":");
+    sink.writeInt(layout.width);
+    sink.write(",\"height\":");
+    sink.writeInt(layout.levelStart.size() - 1);
+    sink.write(",\"nodes\":[");
+    forEachPlaced(layout, [&](uint32_t i, size_t d) {
+      sink.write(i ? ",\n{\"id\":" : "\n{\"id\":");
+      sink.writeInt(i);
+      sink.write(",\"value\":");
+      sink.writeInt(tree.value(i));
+      sink.write(",\"level\":");
+      sink.writeInt(d);
+      sink.write(",\"x\":");
+      sink.writeInt(layout.center(i));
+      sink.write(",\"left\":");
+      writeChildId(tree.left(i), sink);
+      sink.write(",\"right\":");
+      writeChildId(tree.right(i), sink);
+      sink.put('}');
+    });
+    sink.write("]}\n");
+  }
+
+  friend class RenderCache;
+
+public:
+  // Widest drawing print() and printBoxed() produce in their classic form
+  static constexpr size_t kMaxClassicWidth = 4096;
+
+  // Every renderer takes a TreeView, so a TreeNode * draws as stored and
+  // TreeView(root).mirror() draws the mirror image without copying it.
+
+  // Print tree with beautiful ASCII art - handles multi-digit numbers
+  static void print(TreeView root) { print(root, std::cout); }
+
+  static void print(TreeView root, std::ostream &out) {
+    renderTo(out, [root](OutputSink &sink) { renderAscii(root, sink); });
+  }
+
+  // Append the rendering to a string instead of printing it
+  static void print(TreeView root, std::string &out) {
+    OutputSink sink(out);
+    renderAscii(root, sink);
+  }
+
+  // Alternative visualization using box drawing characters
+  static void printBoxed(TreeView root) { printBoxed(root, std::cout); }
+
+  static void printBoxed(TreeView root, std::ostream &out) {
+    renderTo(out, [root](OutputSink &sink) { renderBoxed(root, sink); });
+  }
+
+  static void printBoxed(TreeView root, std::string &out) {
+    OutputSink sink(out);
+    renderBoxed(root, sink);
+  }
+
+  // Width-bounded drawing whose width grows with the node count rather
+  // than 2^height. Falls back to printCompact when wider than maxWidth
+  // columns (0 = never).
+  static void printLayout(TreeView root, size_t maxWidth = 0) {
+    printLayout(root, std::cout, maxWidth);
+  }
+
+  static void printLayout(TreeView root, std::ostream &out,
+                          size_t maxWidth = 0) {
+    renderTo(out, [root, maxWidth](OutputSink &sink) {
+      renderLayout(root, sink, maxWidth);
+    });
+  }
+
+  static void printLayout(TreeView root, std::string &out,
+                          size_t maxWidth = 0) {
+    OutputSink sink(out);
+    renderLayout(root, sink, maxWidth);
+  }
+
+  // Draw only part of the tree: the subtree at view.node or view.path,
+  // down to view.depth levels, clipped to the requested rows and columns.
+  // Subtrees below the cut are shown as "…(n nodes)" markers, so the work
+  // follows the visible part rather than the whole tree.
+  static void printViewport(TreeView root, const TreeViewport &view) {
+    printViewport(root, view, std::cout);
+  }
+
+  static void printViewport(TreeView root, const TreeViewport &view,
+                            std::ostream &out) {
+    renderTo(out, [&](OutputSink &sink) { renderViewport(root, view, sink); });
+  }
+
+  static void printViewport(TreeView root, const TreeViewport &view,
+                            std::string &out) {
+    OutputSink sink(out);
+    renderViewport(root, view, sink);
+  }
+
+  // Print compact representation - better for large trees
+  static void printCompact(TreeView root, const std::string &prefix = "",
+                           bool isLeft = true) {
+    // Output grows with node count times depth, so stream it in blocks
+    // rather than building it whole like the other renderers
+    printCompact(root, std::cout, prefix, isLeft);
+  }
+
+  static void printCompact(TreeView root, std::ostream &out,
+                           const std::string &prefix = "",
+                           bool isLeft = true) {
+    OutputSink sink(out);
+    renderCompact(root, sink, prefix, isLeft);
+  }
+
+  // Graphviz DOT. Each node carries its layout position as pos="x,y!",
+  // which neato -n keeps; dot lays the graph out afresh.
+  static void printDot(TreeView root, std::ostream &out) {
+    OutputSink sink(out);
+    renderDot(root, sink);
+  }
+
+  static void printDot(TreeView root, std::string &out) {
+    OutputSink sink(out);
+    renderDot(root, sink);
+  }
+
+  // Standalone SVG drawing of the printLayout arrangement
+  static void printSvg(TreeView root, std::ostream &out) {
+    OutputSink sink(out);
+    renderSvg(root, sink);
+  }
+
+  static void printSvg(TreeView root, std::string &out) {
+    OutputSink sink(out);
+    renderSvg(root, sink);
+  }
+
+  // {"width":w,"height":h,"nodes":[...]} with one object per node in BFS
+  // order: its id (the BFS index), value, level, center column x and the
+  // ids of its children, or null
+  static void printJson(TreeView root, std::ostream &out) {
+    OutputSink sink(out);
+    renderJson(root, sink);
+  }
+
+  static void printJson(TreeView root, std::string &out) {
+    OutputSink sink(out);
+    renderJson(root, sink);
+  }
+};
+
+// ============================================================================
+// Render Cache
+// ============================================================================
+
+// Finished renderings kept by tree and mode, so printing a tree that has
+// not changed since the last time is a single write of the stored text.
+// A rendering is found by root, orientation and mode, and used only if it
+// was made at the version the caller passes. The caller owns the edits
+// and changes the version whenever the tree may have changed, so a hit
+// costs O(1) and any edit shows up as a miss. For a tree the caller does
+// not control, renderChecked() stands in a 64-bit fingerprint of the
+// values and shape for the version: one read-only walk per call, and a
+// hash collision, however unlikely, would return a stale rendering. The
+// least recently used renderings are dropped once the stored text
+// exceeds the budget. Not thread-safe.
+class RenderCache {
+public:
+  enum class Mode { Ascii, Boxed, Layout, Compact, Dot, Svg, Json };
+
+  static constexpr size_t kDefaultBudget = size_t(64) << 20;
+
+  explicit RenderCache(size_t maxBytes = kDefaultBudget)
+      : maxBytes(maxBytes) {}
+
+  // What TreeVisualizer prints for root in mode; maxWidth is
+  // printLayout's. The text stays valid until the next call.
+  const std::string &render(TreeView root, uint64_t version, Mode mode,
+                            size_t maxWidth = 0) {
+    return lookup({root.node(), root.mirrored(), false, mode, maxWidth},
+                  version, root);
+  }
+
+  // As render(), for a tree whose edits the caller cannot version
+  const std::string &renderChecked(TreeView root, Mode mode,
+                                   size_t maxWidth = 0) {
+    return lookup({root.node(), root.mirrored(), true, mode, maxWidth},
+                  fingerprint(root), root);
+  }
+
+  void print(TreeView root, uint64_t version, Mode mode = Mode::Ascii) {
+    print(root, version, mode, std::cout);
+  }
+
+  void print(TreeView root, uint64_t version, Mode mode, std::ostream &out,
+             size_t maxWidth = 0) {
+    write(render(root, version, mode, maxWidth), out);
+  }
+
+  void printChecked(TreeView root, Mode mode, std::ostream &out,
+                    size_t maxWidth = 0) {
+    write(renderChecked(root, mode, maxWidth), out);
+  }
+
+  void clear() {
+    entries.clear();
+    index.clear();
+    std::string().swap(oversized);
+    bytes = 0;
+  }
+
+  size_t size() const { return entries.size(); }
+  size_t storedBytes() const { return bytes; }
+  size_t hits() const { return hitCount; }
+  size_t misses() const { return missCount; }
+
+private:
+  struct Key {
+    const TreeNode *root;
+    bool mirrored;
+    bool checked; // Versioned by fingerprint
+    Mode mode;
+    size_t maxWidth;
+    bool operator==(const Key &other) const {
+      return root == other.root && mirrored == other.mirrored &&
+             checked == other.checked && mode == other.mode &&
+             maxWidth == other.maxWidth;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key &key) const {
+      uint64_t h = reinterpret_cast<uintptr_t>(key.root);
+      h = h * 0x9e3779b97f4a7c15ULL + static_cast<uint64_t>(key.mode) * 4 +
+          key.checked * 2 + key.mirrored;
+      h = h * 0x9e3779b97f4a7c15ULL + key.maxWidth;
+      return static_cast<size_t>(h ^ (h >> 29));
+    }
+  };
+
+  struct Entry {
+    Key key;
+    uint64_t version;
+    std::string text;
+  };
+
+  const std::string &lookup(const Key &key, uint64_t version,
+                            TreeView root) {
+    auto hit = index.find(key);
+    if (hit != index.end()) {
+      if (hit->second->version == version) {
+        hitCount++;
+        entries.splice(entries.begin(), entries, hit->second);
+        return entries.front().text;
+      }
+      bytes -= hit->second->text.size();
+      entries.erase(hit->second);
+      index.erase(hit);
+    }
+
+    missCount++;
+    std::string text;
+    renderInto(root, key.mode, key.maxWidth, text);
+    if (text.size() > maxBytes) {
+      oversized = std::move(text);
+      return oversized;
+    }
+    bytes += text.size();
+    entries.push_front({key, version, std::move(text)});
+    index[key] = entries.begin();
+    while (bytes > maxBytes) {
+      bytes -= entries.back().text.size();
+      index.erase(entries.back().key);
+      entries.pop_back();
+    }
+    return entries.front().text;
+  }
+
+  static void write(const std::string &text, std::ostream &out) {
+    out.write(text.data(), static_cast<std::streamsize>(text.size()));
+  }
+
+  // Preorder values, each with which children it has, then the node
+  // count, pin down the tree
+  static uint64_t fingerprint(TreeView root) {
+    uint64_t hash = 0x243f6a8885a308d3ULL;
+    if (!root)
+      return hash;
+    auto &stack = scratchStack<TreeNode *>();
+    stack.push_back(root.node());
+    uint64_t nodes = 0;
+    while (!stack.empty()) {
+      TreeNode *node = stack.back();
+      stack.pop_back();
+      uint64_t word = uint64_t(static_cast<uint32_t>(node->val)) << 2 |
+                      (node->left ? 1 : 0) | (node->right ? 2 : 0);
+      hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+      hash ^= hash >> 32;
+      nodes++;
+      if (node->right)
+        stack.push_back(node->right);
+      if (node->left)
+        stack.push_back(node->left);
+    }
+    return (hash ^ nodes) * 0x9e3779b97f4a7c15ULL;
+  }
+
+  static void renderInto(TreeView root, Mode mode, size_t maxWidth,
+                         std::string &text) {
+    OutputSink sink(text);
+    switch (mode) {
+    case Mode::Ascii:
+      TreeVisualizer::renderAscii(root, sink);
+      break;
+    case Mode::Boxed:
+      TreeVisualizer::renderBoxed(root, sink);
+      break;
+    case Mode::Layout:
+      TreeVisualizer::renderLayout(root, sink, maxWidth);
+      break;
+    case Mode::Compact:
+      TreeVisualizer::renderCompact(root, sink, "", true);
+      break;
+    case Mode::Dot:
+      TreeVisualizer::renderDot(root, sink);
+      break;
+    case Mode::Svg:
+      TreeVisualizer::renderSvg(root, sink);
+      break;
+    case Mode::Json:
+      TreeVisualizer::renderJson(root, sink);
+      break;
+    }
+  }
+
+  size_t maxBytes;
+  size_t bytes = 0;
+  size_t hitCount = 0, missCount = 0;
+  std::list<Entry> entries; // Most recently used first
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+  std::string oversized; // Latest rendering too large to keep
+};
+
+// ============================================================================
+// Parallel Execution
+// ============================================================================
+
+// Fixed pool of worker threads for the fork-join overloads in
+// TreeTraversals and TreeOperations. The calling thread works too, and
+// idle threads keep claiming tasks until none are left, so uneven
+// subtrees still balance out.
+class TreeExecutor {
+public:
+  // 0 threads means one per hardware thread
+  explicit TreeExecutor(unsigned threads = 0) {
+    if (threads == 0)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 1; i < threads; i++)
+      workers.emplace_back([this] { workerLoop(); });
+  }
+
+  ~TreeExecutor() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers)
+      worker.join();
+  }
+
+  TreeExecutor(const TreeExecutor &) = delete;
+  TreeExecutor &operator=(const TreeExecutor &) = delete;
+
+  unsigned threadCount() const {
+    return static_cast<unsigned>(workers.size() + 1);
+  }
+
+  // Run task(i) for every i in [0, n) and wait for all of them. Tasks
+  // must not call back into the same executor.
+  template <typename Task> void parallelFor(size_t n, Task &&task) {
+    if (workers.empty() || n <= 1) {
+      for (size_t i = 0; i < n; i++)
+        task(i);
+      return;
+    }
+
+    std::lock_guard<std::mutex> serial(jobMutex);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      // Tasks run as if nested in the caller's profiling probes
+      job = [&task, nesting = ProfileScope::nesting()](size_t i) {
+        ProfileScope::Nesting scope(nesting);
+        task(i);
+      };
+      jobSize = n;
+      next = 0;
+      pending = workers.size();
+      error = nullptr;
+      generation++;
+    }
+    wake.notify_all();
+    runTasks();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pending == 0; });
+    job = nullptr;
+    if (error)
+      std::rethrow_exception(error);
+  }
+
+private:
+  void runTasks() {
+    for (size_t i; (i = next.fetch_add(1)) < jobSize;) {
+      try {
+        job(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error)
+          error = std::current_exception();
+      }
+    }
+  }
+
+  void workerLoop() {
+    size_t seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&] { return stopping || generation != seen; });
+        if (stopping)
+          return;
+        seen = generation;
+      }
+      runTasks();
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--pending == 0)
+        done.notify_one();
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::mutex jobMutex; // Serialises parallelFor calls
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  std::function<void(size_t)> job;
+  size_t jobSize = 0;
+  std::atomic<size_t> next{0};
+  size_t pending = 0;
+  size_t generation = 0;
+  bool stopping = false;
+  std::exception_ptr error;
+};
+
+// FIFO between two threads that holds at most capacity items. push() waits
+// while it is full, so a fast producer is held to its consumer's pace.
+template <typename T> class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity)
+      : capacity(std::max<size_t>(1, capacity)) {}
+
+  void push(T item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notFull.wait(lock, [this] { return items.size() < capacity; });
+    items.push_back(std::move(item));
+    lock.unlock();
+    notEmpty.notify_one();
+  }
+
+  // Waits for an item; false once the queue is closed and drained
+  bool pop(T &item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+    if (items.empty())
+      return false;
+    item = std::move(items.front());
+    items.pop_front();
+    lock.unlock();
+    notFull.notify_one();
+    return true;
+  }
+
+  // No more pushes; pop() drains what is left, then returns false
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+    }
+    notEmpty.notify_all();
+  }
+
+private:
+  size_t capacity;
+  std::deque<T> items;
+  std::mutex mutex;
+  std::condition_variable notEmpty, notFull;
+  bool closed = false;
+};
+
+// Cut a tree at the shallowest level holding enough subtrees to keep every
+// worker busy. Nodes above the cut are few and handled sequentially.
+template <typename T> struct BasicTreeSplit {
+  static constexpr int kMaxDepth = 64;
+  static constexpr size_t kMaxTopNodes = size_t(1) << 16;
+
+  int depth = 0;                    // Level of the subtree roots
+  std::vector<BasicTreeNode<T> *> top;      // Every node above the cut
+  std::vector<BasicTreeNode<T> *> subtrees; // Nodes on the cut level, BFS order
+
+  BasicTreeSplit(BasicTreeNode<T> *root, size_t wanted) {
+    if (root)
+      subtrees.push_back(root);
+    std::vector<BasicTreeNode<T> *> next;
+    while (!subtrees.empty() && subtrees.size() < wanted &&
+           depth < kMaxDepth && top.size() + subtrees.size() <= kMaxTopNodes) {
+      next.clear();
+      for (BasicTreeNode<T> *node : subtrees) {
+        top.push_back(node);
+        if (node->left)
+          next.push_back(node->left);
+        if (node->right)
+          next.push_back(node->right);
+      }
+      subtrees.swap(next);
+      depth++;
+    }
+  }
+
+  // Enough independent subtrees per thread to even out their sizes
+  static size_t wantedFor(const TreeExecutor &exec) {
+    return size_t(exec.threadCount()) * 8;
+  }
+};
+
+using TreeSplit = BasicTreeSplit<int>;
+
+// ============================================================================
+// Parallel Parsing
+// ============================================================================
+
+// Codec::deserialize spread over a TreeExecutor. The input is cut into
+// chunks just after a comma, so no token straddles two chunks, and every
+// chunk is tokenized and parsed on its own. Number the non-null tokens in
+// order: node k's children are then tokens 2k+1 and 2k+2, so a prefix sum
+// of the per-chunk null counts tells each chunk which nodes it fills and
+// which parents it links them under. Trees, errors and offsets match the
+// sequential Codec calls, which small inputs still go through.
+class ParallelCodec {
+public:
+  using ParseStatus = Codec::ParseStatus;
+
+  static FlatTree deserializeFlat(std::string_view data, TreeExecutor &exec) {
+    if (!worthSplitting(data, exec))
+      return Codec::deserializeFlat(data);
+    ParseStatus status;
+    FlatSink sink;
+    parse(data, exec, status, false, sink);
+    if (!status.ok)
+      Codec::throwError(status);
+    return sink.finish();
+  }
+
+  static FlatTree deserializeFlat(std::string_view data, TreeExecutor &exec,
+                                  ParseStatus &status) {
+    if (!worthSplitting(data, exec))
+      return Codec::deserializeFlat(data, status);
+    status = ParseStatus();
+    FlatSink sink;
+    parse(data, exec, status, true, sink);
+    return status.ok ? sink.finish() : FlatTree();
+  }
+
+  // Arena variants. As with Codec::deserialize(data, arena), on error the
+  // partial tree stays in the arena until it is cleared.
+  template <typename T>
+  static BasicTreeNode<T> *deserialize(std::string_view data,
+                                       BasicTreeArena<T> &arena,
+                                       TreeExecutor &exec) {
+    if (!worthSplitting(data, exec))
+      return Codec::deserialize(data, arena);
+    ParseStatus status;
+    ArenaSink<T> sink{arena, {}};
+    parse(data, exec, status, false, sink);
+    if (!status.ok)
+      Codec::throwError(status);
+    return sink.root();
+  }
+
+  template <typename T>
+  static BasicTreeNode<T> *deserialize(std::string_view data,
+                                       BasicTreeArena<T> &arena,
+                                       TreeExecutor &exec,
+                                       ParseStatus &status) {
+    if (!worthSplitting(data, exec))
+      return Codec::deserialize(data, arena, status);
+    status = ParseStatus();
+    ArenaSink<T> sink{arena, {}};
+    parse(data, exec, status, true, sink);
+    return status.ok ? sink.root() : nullptr;
+  }
+
+private:
+  // Below this many bytes per chunk the sequential parser is faster
+  static constexpr size_t kMinChunkBytes = size_t(1) << 16;
+  static constexpr size_t kNone = SIZE_MAX;
+
+  static bool worthSplitting(std::string_view data, const TreeExecutor &exec) {
+    return exec.threadCount() > 1 && data.size() >= 2 * kMinChunkBytes;
+  }
+
+  template <typename T> struct Chunk {
+    std::string_view text;
+    size_t begin = 0;           // Offset of text in the input
+    std::vector<T> values;      // Non-null tokens, in order
+    std::vector<uint8_t> nulls; // One flag per token
+    size_t firstBad = kNone;    // Index of the first token that failed
+    ParseStatus error;          // ... and why
+    long long minSlack = 0;     // Lowest 2 * (non-null so far) - index
+    size_t tokenBase = 0;       // Tokens in earlier chunks
+    size_t nodeBase = 0;        // Non-null tokens in earlier chunks
+  };
+
+  // Tokenize and parse one chunk. A bad token only matters if the tree
+  // reaches it, which is not known yet, so it is recorded and scanning
+  // goes on with a placeholder value.
+  template <typename T> static void scan(Chunk<T> &chunk, bool strict) {
+    Codec::TokenScanner scanner(chunk.text);
+    Codec::Token tok;
+    long long slack = 0;
+    for (size_t j = 0; scanner.next(tok); j++) {
+      chunk.minSlack = std::min(chunk.minSlack, slack);
+      bool null = Codec::isNull(tok);
+      chunk.nulls.push_back(null);
+      if (null) {
+        slack--;
+        continue;
+      }
+      slack++;
+      T val{};
+      tok.offset += chunk.begin;
+      if (chunk.firstBad == kNone) {
+        if (!Codec::parseValue(tok, strict, val, chunk.error))
+          chunk.firstBad = j;
+      } else {
+        ParseStatus ignored;
+        Codec::parseValue(tok, strict, val, ignored);
+      }
+      chunk.values.push_back(val);
+    }
+    chunk.minSlack = std::min(chunk.minSlack, slack);
+  }
+
+  // Token i is read while i < 1 + 2 * (non-null tokens before i); the first
+  // index past that ends the parse. Returns {tokens read, nodes built}.
+  template <typename T>
+  static std::pair<size_t, size_t>
+  consumed(const std::vector<Chunk<T>> &chunks) {
+    for (const Chunk<T> &chunk : chunks) {
+      long long base = 1 + 2 * static_cast<long long>(chunk.nodeBase) -
+                       static_cast<long long>(chunk.tokenBase);
+      if (base + chunk.minSlack > 0)
+        continue;
+      long long slack = 0;
+      size_t nodes = chunk.nodeBase;
+      for (size_t j = 0;; j++) {
+        if (base + slack <= 0)
+          return {chunk.tokenBase + j, nodes};
+        bool null = chunk.nulls[j];
+        slack += null ? -1 : 1;
+        nodes += !null;
+      }
+    }
+    const Chunk<T> &last = chunks.back();
+    return {last.tokenBase + last.nulls.size(),
+            last.nodeBase + last.values.size()};
+  }
+
+  template <typename Sink>
+  static void parse(std::string_view data, TreeExecutor &exec,
+                    ParseStatus &status, bool strict, Sink &sink) {
+    using T = typename Sink::Value;
+    TREE_PROFILE_SCOPE("ParallelCodec::deserialize");
+    TREE_PROFILE_BYTES_IN(data.size());
+
+    // Cut after the first comma at or past each even split point
+    size_t parts = std::min<size_t>(size_t(exec.threadCount()) * 4,
+                                    data.size() / kMinChunkBytes);
+    std::vector<Chunk<T>> chunks(1);
+    for (size_t c = 1; c < parts; c++) {
+      size_t at = std::max(chunks.back().begin, data.size() / parts * c);
+      size_t comma = data.find(',', at);
+      if (comma == std::string_view::npos)
+        break;
+      chunks.emplace_back().begin = comma + 1;
+    }
+    for (size_t c = 0; c < chunks.size(); c++) {
+      size_t end = c + 1 < chunks.size() ? chunks[c + 1].begin : data.size();
+      chunks[c].text = data.substr(chunks[c].begin, end - chunks[c].begin);
+    }
+
+    exec.parallelFor(chunks.size(),
+                     [&](size_t c) { scan(chunks[c], strict); });
+
+    for (size_t c = 1; c < chunks.size(); c++) {
+      const Chunk<T> &prev = chunks[c - 1];
+      chunks[c].tokenBase = prev.tokenBase + prev.nulls.size();
+      chunks[c].nodeBase = prev.nodeBase + prev.values.size();
+    }
+    auto [tokens, nodes] = consumed(chunks);
+
+    // The sequential parser stops at the first bad token it reads
+    for (const Chunk<T> &chunk : chunks) {
+      if (chunk.firstBad == kNone)
+        continue;
+      if (chunk.tokenBase + chunk.firstBad < tokens)
+        status = chunk.error;
+      break;
+    }
+    if (!status.ok || nodes == 0)
+      return;
+
+    sink.resize(nodes);
+    exec.parallelFor(chunks.size(), [&](size_t c) {
+      const Chunk<T> &chunk = chunks[c];
+      size_t node = chunk.nodeBase;
+      for (size_t j = 0; j < chunk.nulls.size(); j++) {
+        size_t i = chunk.tokenBase + j;
+        if (i >= tokens)
+          break;
+        if (chunk.nulls[j])
+          continue;
+        sink.place(node, chunk.values[node - chunk.nodeBase]);
+        if (i > 0)
+          sink.link((i - 1) / 2, node, i % 2 == 1);
+        node++;
+      }
+    });
+    TREE_PROFILE_NODES(nodes);
+  }
+
+  // Every slot is written by exactly one token, so chunks never race
+  struct FlatSink {
+    using Value = int;
+
+    std::vector<int> values;
+    std::vector<uint32_t> lefts, rights;
+
+    void resize(size_t n) {
+      if (n > FlatTree::npos)
+        throw std::length_error("FlatTree: too many nodes");
+      values.resize(n);
+      lefts.assign(n, FlatTree::npos);
+      rights.assign(n, FlatTree::npos);
+    }
+    void place(size_t node, int val) { values[node] = val; }
+    void link(size_t parent, size_t child, bool left) {
+      (left ? lefts : rights)[parent] = static_cast<uint32_t>(child);
+    }
+    FlatTree finish() {
+      return FlatTree::fromArrays(std::move(values), std::move(lefts),
+                                  std::move(rights));
+    }
+  };
+
+  // The arena is not thread-safe, so nodes are created up front in order
+  template <typename T> struct ArenaSink {
+    using Value = T;
+
+    BasicTreeArena<T> &arena;
+    std::vector<BasicTreeNode<T> *> nodes;
+
+    void resize(size_t n) {
+      arena.reserve(n);
+      nodes.resize(n);
+      for (auto &node : nodes)
+        node = arena.create(T());
+    }
+    void place(size_t node, T val) { nodes[node]->val = val; }
+    void link(size_t parent, size_t child, bool left) {
+      (left ? nodes[parent]->left : nodes[parent]->right) = nodes[child];
+    }
+    BasicTreeNode<T> *root() const {
+      return nodes.empty() ? nullptr : nodes[0];
+    }
+  };
+};
+
+// ============================================================================
+// Tree Traversals
+// ============================================================================
+
+// Level order as one array of values plus level offsets (CSR): level d
+// is values[offsets[d]] up to values[offsets[d + 1]]
+template <typename T> struct BasicLevels {
+  std::vector<T> values;        // All levels, root first
+  std::vector<size_t> offsets;  // One per level, plus values.size()
+
+  size_t size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+  const T *begin(size_t d) const { return values.data() + offsets[d]; }
+  const T *end(size_t d) const { return values.data() + offsets[d + 1]; }
+};
+
+using TreeLevels = BasicLevels<int>;
+
+class TreeTraversals {
+public:
+  template <typename T>
+  static std::vector<T> inorder(BasicTreeNode<T> *root) {
+    TREE_PROFILE_SCOPE("TreeTraversals::inorder");
+    std::vector<T> result = collect(root, Order::In);
+    TREE_PROFILE_NODES(result.size());
+    return result;
+  }
+
+  template <typename T>
+  static std::vector<T> preorder(BasicTreeNode<T> *root) {
+    TREE_PROFILE_SCOPE("TreeTraversals::preorder");
+    std::vector<T> result = collect(root, Order::Pre);
+    TREE_PROFILE_NODES(result.size());
+    return result;
+  }
+
+  template <typename T>
+  static std::vector<T> postorder(BasicTreeNode<T> *root) {
+    TREE_PROFILE_SCOPE("TreeTraversals::postorder");
+    std::vector<T> result = collect(root, Order::Post);
+    TREE_PROFILE_NODES(result.size());
+    return result;
+  }
+
+  // Parallel versions: identical output, subtrees filled concurrently
+  template <typename T>
+  static std::vector<T> inorder(BasicTreeNode<T> *root, TreeExecutor &exec) {
+    TREE_PROFILE_SCOPE("TreeTraversals::inorder[par]");
+    std::vector<T> result = collect(root, Order::In, exec);
+    TREE_PROFILE_NODES(result.size());
+    return result;
+  }
+
+  template <typename T>
+  static std::vector<T> preorder(BasicTreeNode<T> *root, TreeExecutor &exec) {
+    TREE_PROFILE_SCOPE("TreeTraversals::preorder[par]");
+    std::vector<T> result = collect(root, Order::Pre, exec);
+    TREE_PROFILE_NODES(result.size());
+    return result;
+  }
+
+  template <typename T>
+  static std::vector<T> postorder(BasicTreeNode<T> *root, TreeExecutor &exec) {
+    TREE_PROFILE_SCOPE("TreeTraversals::postorder[par]");
+    std::vector<T> result = collect(root, Order::Post, exec);
+    TREE_PROFILE_NODES(result.size());
+    return result;
+  }
+
+  template <typename T>
+  static std::vector<std::vector<T>> levelOrder(BasicTreeNode<T> *root) {
+    TREE_PROFILE_SCOPE("TreeTraversals::levelOrder");
+    std::vector<std::vector<T>> result;
+    forEachTreeLevel(root, [&](const auto &level, int) {
+      std::vector<T> &values = result.emplace_back();
+      values.reserve(level.size());
+      for (BasicTreeNode<T> *node : level)
+        values.push_back(node->val);
+      TREE_PROFILE_NODES(level.size());
+      return true;
+    });
+    return result;
+  }
+
+  // Same values as levelOrder, without a vector per level
+  template <typename T>
+  static BasicLevels<T> levelOrderFlat(BasicTreeNode<T> *root) {
+    TREE_PROFILE_SCOPE("TreeTraversals::levelOrderFlat");
+    BasicLevels<T> result;
+    forEachTreeLevel(root, [&result](const auto &level, int) {
+      result.offsets.push_back(result.values.size());
+      for (BasicTreeNode<T> *node : level)
+        result.values.push_back(node->val);
+      return true;
+    });
+    result.offsets.push_back(result.values.size());
+    TREE_PROFILE_NODES(result.values.size());
+    return result;
+  }
+
+  // visit(values, level) once per level with that level's values; only
+  // one level is held at a time. A visit that returns bool stops the walk
+  // by returning false, and the call then returns false too.
+  template <typename T, typename Visit>
+  static bool forEachLevel(BasicTreeNode<T> *root, Visit &&visit) {
+    std::vector<T> values;
+    return forEachTreeLevel(root, [&](const auto &level, int depth) {
+      values.clear();
+      for (BasicTreeNode<T> *node : level)
+        values.push_back(node->val);
+      return proceed(visit, static_cast<const std::vector<T> &>(values),
+                     depth);
+    });
+  }
+
+  // ---- Mirrored views ------------------------------------------------------
+  // A mirror's orders follow from the stored tree's: inorder reversed,
+  // preorder is the reversed postorder and the other way round, and level
+  // order reverses each level.
+
+  template <typename T> static std::vector<T> inorder(BasicTreeView<T> view) {
+    std::vector<T> result = inorder(view.node());
+    if (view.mirrored())
+      std::reverse(result.begin(), result.end());
+    return result;
+  }
+
+  template <typename T>
+  static std::vector<T> preorder(BasicTreeView<T> view) {
+    if (!view.mirrored())
+      return preorder(view.node());
+    std::vector<T> result = postorder(view.node());
+    std::reverse(result.begin(), result.end());
+    return result;
+  }
+
+  template <typename T>
+  static std::vector<T> postorder(BasicTreeView<T> view) {
+    if (!view.mirrored())
+      return postorder(view.node());
+    std::vector<T> result = preorder(view.node());
+    std::reverse(result.begin(), result.end());
+    return result;
+  }
+
+  template <typename T>
+  static std::vector<std::vector<T>> levelOrder(BasicTreeView<T> view) {
+    std::vector<std::vector<T>> result = levelOrder(view.node());
+    if (view.mirrored())
+      for (std::vector<T> &level : result)
+        std::reverse(level.begin(), level.end());
+    return result;
+  }
+
+  template <typename T>
+  static BasicLevels<T> levelOrderFlat(BasicTreeView<T> view) {
+    BasicLevels<T> result = levelOrderFlat(view.node());
+    if (view.mirrored())
+      for (size_t d = 0; d < result.size(); d++)
+        std::reverse(result.values.begin() + result.offsets[d],
+                     result.values.begin() + result.offsets[d + 1]);
+    return result;
+  }
+
+  // ---- Streaming versions -------------------------------------------------
+  // Nothing is collected: values go straight to the caller. These walk with
+  // an explicit stack (a queue for level order) and never modify the tree,
+  // so the caller may read it, or stop, at any point.
+
+  enum class Order { Pre, In, Post, Level };
+
+  // Lazy walk in one order. Its iterators are independent forward
+  // iterators over the node values; copying one copies the pending stack.
+  template <Order O, typename T = int> class Range {
+  public:
+    class iterator {
+    public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = T;
+      using difference_type = std::ptrdiff_t;
+      using pointer = const T *;
+      using reference = const T &;
+
+      iterator() = default;
+      explicit iterator(BasicTreeNode<T> *root) {
+        if (!root)
+          return;
+        if constexpr (O == Order::In)
+          pushLeft(root);
+        else
+          pending.push_back({root, 0});
+        ++*this;
+      }
+
+      reference operator*() const { return current->val; }
+      pointer operator->() const { return &current->val; }
+      BasicTreeNode<T> *node() const { return current; }
+
+      // Depth of the current node, root = 0 (level order only)
+      int level() const {
+        static_assert(O == Order::Level, "level() needs level order");
+        return currentLevel;
+      }
+
+      iterator &operator++() {
+        current = nullptr;
+        if constexpr (O == Order::Pre) {
+          if (pending.empty())
+            return *this;
+          current = pending.back().node;
+          pending.pop_back();
+          if (current->right)
+            pending.push_back({current->right, 0});
+          if (current->left)
+            pending.push_back({current->left, 0});
+        } else if constexpr (O == Order::In) {
+          if (pending.empty())
+            return *this;
+          current = pending.back().node;
+          pending.pop_back();
+          pushLeft(current->right);
+        } else if constexpr (O == Order::Post) {
+          // tag marks a node whose children are already pending
+          while (!pending.empty()) {
+            Frame &top = pending.back();
+            if (top.tag) {
+              current = top.node;
+              pending.pop_back();
+              return *this;
+            }
+            top.tag = 1;
+            BasicTreeNode<T> *node = top.node;
+            if (node->right)
+              pending.push_back({node->right, 0});
+            if (node->left)
+              pending.push_back({node->left, 0});
+          }
+        } else {
+          // tag is the level
+          if (pending.empty())
+            return *this;
+          current = pending.front().node;
+          currentLevel = pending.front().tag;
+          pending.pop_front();
+          if (current->left)
+            pending.push_back({current->left, currentLevel + 1});
+          if (current->right)
+            pending.push_back({current->right, currentLevel + 1});
+        }
+        return *this;
+      }
+
+      iterator operator++(int) {
+        iterator old = *this;
+        ++*this;
+        return old;
+      }
+
+      // Each node appears once per walk, so the node identifies the position
+      bool operator==(const iterator &other) const {
+        return current == other.current;
+      }
+      bool operator!=(const iterator &other) const {
+        return current != other.current;
+      }
+
+    private:
+      struct Frame {
+        BasicTreeNode<T> *node;
+        int tag;
+      };
+
+      void pushLeft(BasicTreeNode<T> *node) {
+        for (; node; node = node->left)
+          pending.push_back({node, 0});
+      }
+
+      BasicTreeNode<T> *current = nullptr;
+      int currentLevel = 0;
+      // A stack, or a queue for level order
+      std::conditional_t<O == Order::Level, std::deque<Frame>,
+                         std::vector<Frame>>
+          pending;
+    };
+
+    explicit Range(BasicTreeNode<T> *root) : root(root) {}
+    iterator begin() const { return iterator(root); }
+    iterator end() const { return iterator(); }
+
+  private:
+    BasicTreeNode<T> *root;
+  };
+
+  template <typename T>
+  static Range<Order::In, T> inorderRange(BasicTreeNode<T> *root) {
+    return Range<Order::In, T>(root);
+  }
+  template <typename T>
+  static Range<Order::Pre, T> preorderRange(BasicTreeNode<T> *root) {
+    return Range<Order::Pre, T>(root);
+  }
+  template <typename T>
+  static Range<Order::Post, T> postorderRange(BasicTreeNode<T> *root) {
+    return Range<Order::Post, T>(root);
+  }
+  template <typename T>
+  static Range<Order::Level, T> levelOrderRange(BasicTreeNode<T> *root) {
+    return Range<Order::Level, T>(root);
+  }
+
+  // visit(val) for each value. A visit that returns bool stops the walk by
+  // returning false, and the call then returns false too. In level order
+  // visit may take (val, level) instead.
+  template <typename T, typename Visit>
+  static bool forEachInorder(BasicTreeNode<T> *root, Visit &&visit) {
+    return forEach<Order::In>(root, visit);
+  }
+  template <typename T, typename Visit>
+  static bool forEachPreorder(BasicTreeNode<T> *root, Visit &&visit) {
+    return forEach<Order::Pre>(root, visit);
+  }
+  template <typename T, typename Visit>
+  static bool forEachPostorder(BasicTreeNode<T> *root, Visit &&visit) {
+    return forEach<Order::Post>(root, visit);
+  }
+  template <typename T, typename Visit>
+  static bool forEachLevelOrder(BasicTreeNode<T> *root, Visit &&visit) {
+    return forEach<Order::Level>(root, visit);
+  }
+
+  // Write the values through an output iterator, e.g. into a preallocated
+  // buffer, and return the iterator past the last one written
+  template <typename T, typename Out>
+  static Out copyInorder(BasicTreeNode<T> *root, Out out) {
+    return copy<Order::In>(root, out);
+  }
+  template <typename T, typename Out>
+  static Out copyPreorder(BasicTreeNode<T> *root, Out out) {
+    return copy<Order::Pre>(root, out);
+  }
+  template <typename T, typename Out>
+  static Out copyPostorder(BasicTreeNode<T> *root, Out out) {
+    return copy<Order::Post>(root, out);
+  }
+  template <typename T, typename Out>
+  static Out copyLevelOrder(BasicTreeNode<T> *root, Out out) {
+    return copy<Order::Level>(root, out);
+  }
+
+private:
+  template <Order O, typename T, typename Visit>
+  static bool forEach(BasicTreeNode<T> *root, Visit &visit) {
+    if constexpr (O == Order::Level)
+      return forEachTreeLevel(root, [&visit](const auto &level, int depth) {
+        for (BasicTreeNode<T> *node : level) {
+          bool more;
+          if constexpr (std::is_invocable_v<Visit &, T, int>)
+            more = proceed(visit, node->val, depth);
+          else
+            more = proceed(visit, node->val);
+          if (!more)
+            return false;
+        }
+        return true;
+      });
+    for (typename Range<O, T>::iterator it(root); it.node(); ++it) {
+      bool more;
+      if constexpr (O == Order::Level && std::is_invocable_v<Visit &, T, int>)
+        more = proceed(visit, *it, it.level());
+      else
+        more = proceed(visit, *it);
+      if (!more)
+        return false;
+    }
+    return true;
+  }
+
+  template <typename Visit, typename... Args>
+  static bool proceed(Visit &visit, Args... args) {
+    if constexpr (std::is_void_v<std::invoke_result_t<Visit &, Args...>>) {
+      visit(args...);
+      return true;
+    } else {
+      return static_cast<bool>(visit(args...));
+    }
+  }
+
+  template <Order O, typename T, typename Out>
+  static Out copy(BasicTreeNode<T> *root, Out out) {
+    auto write = [&out](T val) { *out++ = val; };
+    forEach<O>(root, write);
+    return out;
+  }
+
+  template <typename T>
+  static std::vector<T> collect(BasicTreeNode<T> *root, Order order) {
+    std::vector<T> result;
+    auto emit = [&result](T val) { result.push_back(val); };
+    walk(root, order, emit);
+    return result;
+  }
+
+  // Call emit(val) for every node in the given order
+  template <typename T, typename Emit>
+  static void walk(BasicTreeNode<T> *root, Order order, Emit &emit) {
+    switch (order) {
+    case Order::Pre:
+      preorderHelper(root, emit, 0);
+      break;
+    case Order::In:
+      inorderHelper(root, emit, 0);
+      break;
+    case Order::Post:
+      postorderHelper(root, emit, 0);
+      break;
+    case Order::Level:
+      forEach<Order::Level>(root, emit);
+      break;
+    }
+  }
+
+  // One entry of the order seen from the top of a TreeSplit: either a
+  // single top node or a whole subtree below the cut
+  template <typename T> struct Piece {
+    BasicTreeNode<T> *node;
+    bool subtree;
+  };
+
+  template <typename T>
+  static void piecesOf(BasicTreeNode<T> *node, int depth,
+                       const BasicTreeSplit<T> &split, Order order,
+                       std::vector<Piece<T>> &pieces) {
+    if (!node)
+      return;
+    if (depth == split.depth) {
+      pieces.push_back({node, true});
+      return;
+    }
+    if (order == Order::Pre)
+      pieces.push_back({node, false});
+    piecesOf(node->left, depth + 1, split, order, pieces);
+    if (order == Order::In)
+      pieces.push_back({node, false});
+    piecesOf(node->right, depth + 1, split, order, pieces);
+    if (order == Order::Post)
+      pieces.push_back({node, false});
+  }
+
+  // Size every subtree in parallel, turn the sizes into write offsets, then
+  // let each subtree fill its own slice of one preallocated vector
+  template <typename T>
+  static std::vector<T> collect(BasicTreeNode<T> *root, Order order,
+                                TreeExecutor &exec) {
+    if (exec.threadCount() == 1)
+      return collect(root, order);
+
+    BasicTreeSplit<T> split(root, TreeSplit::wantedFor(exec));
+    std::vector<Piece<T>> pieces;
+    piecesOf(root, 0, split, order, pieces);
+
+    std::vector<size_t> offsets(pieces.size() + 1, 0);
+    exec.parallelFor(pieces.size(), [&](size_t i) {
+      offsets[i + 1] = pieces[i].subtree ? countNodes(pieces[i].node) : 1;
+    });
+    for (size_t i = 0; i < pieces.size(); i++)
+      offsets[i + 1] += offsets[i];
+
+    std::vector<T> result(offsets.back());
+    exec.parallelFor(pieces.size(), [&](size_t i) {
+      T *out = result.data() + offsets[i];
+      if (!pieces[i].subtree) {
+        *out = pieces[i].node->val;
+        return;
+      }
+      auto emit = [&out](T val) { *out++ = val; };
+      walk(pieces[i].node, order, emit);
+    });
+    return result;
+  }
+
+  template <typename T>
+  static size_t countNodes(BasicTreeNode<T> *root) {
+    size_t count = 0;
+    auto emit = [&count](T) { count++; };
+    walk(root, Order::Pre, emit);
+    return count;
+  }
+
+  template <typename T, typename Emit>
+  static void inorderHelper(BasicTreeNode<T> *root, Emit &emit, int depth) {
+    if (!root)
+      return;
+    if (depth > kMaxRecursionDepth) {
+      iterativeInorder(root, emit);
+      return;
+    }
+    inorderHelper(root->left, emit, depth + 1);
+    emit(root->val);
+    inorderHelper(root->right, emit, depth + 1);
+  }
+
+  template <typename T, typename Emit>
+  static void preorderHelper(BasicTreeNode<T> *root, Emit &emit, int depth) {
+    if (!root)
+      return;
+    if (depth > kMaxRecursionDepth) {
+      iterativePreorder(root, emit);
+      return;
+    }
+    emit(root->val);
+    preorderHelper(root->left, emit, depth + 1);
+    preorderHelper(root->right, emit, depth + 1);
+  }
+
+  template <typename T, typename Emit>
+  static void postorderHelper(BasicTreeNode<T> *root, Emit &emit, int depth) {
+    if (!root)
+      return;
+    if (depth > kMaxRecursionDepth) {
+      iterativePostorder(root, emit);
+      return;
+    }
+    postorderHelper(root->left, emit, depth + 1);
+    postorderHelper(root->right, emit, depth + 1);
+    emit(root->val);
+  }
+
+  // Explicit-stack engines for trees too deep to recurse. They only read
+  // the nodes, so any number of threads may walk one tree at once.
+  template <typename T, typename Emit>
+  static void iterativeInorder(BasicTreeNode<T> *root, Emit &emit) {
+    auto &stack = scratchStack<BasicTreeNode<T> *>();
+    BasicTreeNode<T> *cur = root;
+    while (cur || !stack.empty()) {
+      for (; cur; cur = cur->left)
+        stack.push_back(cur);
+      cur = stack.back();
+      stack.pop_back();
+      emit(cur->val);
+      cur = cur->right;
+    }
+  }
+
+  template <typename T, typename Emit>
+  static void iterativePreorder(BasicTreeNode<T> *root, Emit &emit) {
+    auto &stack = scratchStack<BasicTreeNode<T> *>();
+    if (root)
+      stack.push_back(root);
+    while (!stack.empty()) {
+      BasicTreeNode<T> *node = stack.back();
+      stack.pop_back();
+      emit(node->val);
+      if (node->right)
+        stack.push_back(node->right);
+      if (node->left)
+        stack.push_back(node->left);
+    }
+  }
+
+  template <typename T, typename Emit>
+  static void iterativePostorder(BasicTreeNode<T> *root, Emit &emit) {
+    auto &stack = scratchStack<BasicTreeNode<T> *>();
+    BasicTreeNode<T> *cur = root, *last = nullptr;
+    while (cur || !stack.empty()) {
+      if (cur) {
+        stack.push_back(cur);
+        cur = cur->left;
+        continue;
+      }
+      BasicTreeNode<T> *top = stack.back();
+      if (top->right && top->right != last) {
+        cur = top->right;
+      } else {
+        emit(top->val);
+        last = top;
+        stack.pop_back();
+      }
+    }
+  }
+};
+
+// ============================================================================
+// Tree Operations
+// ============================================================================
+
+// Everything TreeOperations can report about a tree, gathered in one pass.
+// Empty trees get the same values as the individual calls.
+template <typename T> struct BasicTreeStats {
+  int height = 0;
+  int nodeCount = 0;
+  int leafCount = 0;
+  typename TreeValue<T>::Sum sum = 0;
+  T minValue = std::numeric_limits<T>::max();
+  T maxValue = std::numeric_limits<T>::lowest();
+  int diameter = 0;
+  bool isBST = true;
+  bool isBalanced = true;
+
+  // Stats of the tree val(left, right) from those of its subtrees, each
+  // default-constructed when empty. Every incremental and one-pass stats
+  // computation goes through here.
+  static BasicTreeStats combine(T val, const BasicTreeStats &left,
+                                const BasicTreeStats &right) {
+    BasicTreeStats s;
+    s.height = 1 + std::max(left.height, right.height);
+    s.nodeCount = 1 + left.nodeCount + right.nodeCount;
+    s.leafCount = !left.nodeCount && !right.nodeCount
+                      ? 1
+                      : left.leafCount + right.leafCount;
+    s.sum = val + left.sum + right.sum;
+    s.minValue = std::min({val, left.minValue, right.minValue});
+    s.maxValue = std::max({val, left.maxValue, right.maxValue});
+    s.diameter = std::max(
+        {left.diameter, right.diameter, left.height + right.height});
+    s.isBST = left.isBST && right.isBST &&
+              (!left.nodeCount || left.maxValue < val) &&
+              (!right.nodeCount || val < right.minValue);
+    s.isBalanced = left.isBalanced && right.isBalanced &&
+                   std::abs(left.height - right.height) <= 1;
+    return s;
+  }
+};
+
+using TreeStats = BasicTreeStats<int>;
+
+class TreeOperations {
+public:
+  template <typename T> static int height(BasicTreeNode<T> *root) {
+    TREE_PROFILE_SCOPE("TreeOperations::height");
+    return fold(root, 0, [](BasicTreeNode<T> *, int left, int right) {
+      return 1 + std::max(left, right);
+    });
+  }
+
+  template <typename T> static int countNodes(BasicTreeNode<T> *root) {
+    TREE_PROFILE_SCOPE("TreeOperations::countNodes");
+    return fold(root, 0, [](BasicTreeNode<T> *, int left, int right) {
+      return 1 + left + right;
+    });
+  }
+
+  template <typename T> static int countLeaves(BasicTreeNode<T> *root) {
+    TREE_PROFILE_SCOPE("TreeOperations::countLeaves");
+    return fold(root, 0, [](BasicTreeNode<T> *node, int left, int right) {
+      return !node->left && !node->right ? 1 : left + right;
+    });
+  }
+
+  // Accumulated in TreeValue<T>::Sum, so an int tree's total cannot wrap
+  template <typename T>
+  static typename TreeValue<T>::Sum sum(BasicTreeNode<T> *root) {
+    TREE_PROFILE_SCOPE("TreeOperations::sum");
+    using Sum = typename TreeValue<T>::Sum;
+    return fold(root, Sum(0), [](BasicTreeNode<T> *node, Sum left, Sum right) {
+      return Sum(node->val) + left + right;
+    });
+  }
+
+  template <typename T> static T minValue(BasicTreeNode<T> *root) {
+    TREE_PROFILE_SCOPE("TreeOperations::minValue");
+    return fold(root, std::numeric_limits<T>::max(),
+                [](BasicTreeNode<T> *node, T left, T right) {
+                  return std::min({node->val, left, right});
+                });
+  }
+
+  template <typename T> static T maxValue(BasicTreeNode<T> *root) {
+    TREE_PROFILE_SCOPE("TreeOperations::maxValue");
+    return fold(root, std::numeric_limits<T>::lowest(),
+                [](BasicTreeNode<T> *node, T left, T right) {
+                  return std::max({node->val, left, right});
+                });
+  }
+
+  template <typename T> static int diameter(BasicTreeNode<T> *root) {
+    TREE_PROFILE_SCOPE("TreeOperations::diameter");
+    int result = 0;
+    fold(root, 0, [&result](BasicTreeNode<T> *, int left, int right) {
+      result = std::max(result, left + right);
+      return 1 + std::max(left, right);
+    });
+    return result;
+  }
+
+  template <typename T> static bool isBalanced(BasicTreeNode<T> *root) {
+    TREE_PROFILE_SCOPE("TreeOperations::isBalanced");
+    // Height of the subtree, or -1 once any subtree is out of balance
+    int height = fold(root, 0, [](BasicTreeNode<T> *, int left, int right) {
+      if (left == -1 || right == -1 || std::abs(left - right) > 1)
+        return -1;
+      return 1 + std::max(left, right);
+    });
+    return height != -1;
+  }
+
+  // All of the above from a single post-order pass
+  template <typename T>
+  static BasicTreeStats<T> stats(BasicTreeNode<T> *root) {
+    TREE_PROFILE_SCOPE("TreeOperations::stats");
+    using Stats = BasicTreeStats<T>;
+    Stats total = fold(root, Stats(),
+                       [](BasicTreeNode<T> *node, const Stats &left,
+                          const Stats &right) {
+                         return Stats::combine(node->val, left, right);
+                       });
+    TREE_PROFILE_NODES(total.nodeCount);
+    return total;
+  }
+
+  template <typename T> static bool isBST(BasicTreeNode<T> *root) {
+    TREE_PROFILE_SCOPE("TreeOperations::isBST");
+    return isBSTWithin<T>(root, nullptr, nullptr);
+  }
+
+  // ---- Parallel versions ---------------------------------------------------
+  // Same results as the sequential calls: subtrees below a TreeSplit are
+  // reduced concurrently and combined with the few nodes above the cut.
+
+  template <typename T>
+  static int countNodes(BasicTreeNode<T> *root, TreeExecutor &exec) {
+    TREE_PROFILE_SCOPE("TreeOperations::countNodes[par]");
+    return reduce(
+        root, exec, 0, [](BasicTreeNode<T> *) { return 1; },
+        [](BasicTreeNode<T> *sub) { return countNodes(sub); },
+        [](int a, int b) { return a + b; });
+  }
+
+  template <typename T>
+  static typename TreeValue<T>::Sum sum(BasicTreeNode<T> *root,
+                                        TreeExecutor &exec) {
+    TREE_PROFILE_SCOPE("TreeOperations::sum[par]");
+    using Sum = typename TreeValue<T>::Sum;
+    return reduce(
+        root, exec, Sum(0),
+        [](BasicTreeNode<T> *node) { return Sum(node->val); },
+        [](BasicTreeNode<T> *sub) { return sum(sub); },
+        [](Sum a, Sum b) { return a + b; });
+  }
+
+  template <typename T>
+  static T minValue(BasicTreeNode<T> *root, TreeExecutor &exec) {
+    TREE_PROFILE_SCOPE("TreeOperations::minValue[par]");
+    return reduce(
+        root, exec, std::numeric_limits<T>::max(),
+        [](BasicTreeNode<T> *node) { return node->val; },
+        [](BasicTreeNode<T> *sub) { return minValue(sub); },
+        [](T a, T b) { return std::min(a, b); });
+  }
+
+  template <typename T>
+  static T maxValue(BasicTreeNode<T> *root, TreeExecutor &exec) {
+    TREE_PROFILE_SCOPE("TreeOperations::maxValue[par]");
+    return reduce(
+        root, exec, std::numeric_limits<T>::lowest(),
+        [](BasicTreeNode<T> *node) { return node->val; },
+        [](BasicTreeNode<T> *sub) { return maxValue(sub); },
+        [](T a, T b) { return std::max(a, b); });
+  }
+
+  // Check the nodes above the cut while collecting the bounds each subtree
+  // below it must respect, then check those subtrees in parallel
+  template <typename T>
+  static bool isBST(BasicTreeNode<T> *root, TreeExecutor &exec) {
+    TREE_PROFILE_SCOPE("TreeOperations::isBST[par]");
+    if (exec.threadCount() == 1)
+      return isBST(root);
+
+    BasicTreeSplit<T> split(root, TreeSplit::wantedFor(exec));
+    std::vector<BoundsFrame<T>> subtrees;
+    if (!boundsAboveCut<T>(root, nullptr, nullptr, 0, split.depth, subtrees))
+      return false;
+
+    std::atomic<bool> ok{true};
+    exec.parallelFor(subtrees.size(), [&](size_t i) {
+      if (ok.load(std::memory_order_relaxed) &&
+          !isBSTWithin(subtrees[i].node, subtrees[i].minVal,
+                       subtrees[i].maxVal))
+        ok.store(false, std::memory_order_relaxed);
+    });
+    return ok;
+  }
+
+  template <typename T>
+  static BasicTreeNode<T> *mirror(BasicTreeNode<T> *root) {
+    TREE_PROFILE_SCOPE("TreeOperations::mirror");
+    return mirrorInto(root, [](T val) { return new BasicTreeNode<T>(val); });
+  }
+
+  // Mirrored copy whose nodes live in the arena
+  template <typename T>
+  static BasicTreeNode<T> *mirror(BasicTreeNode<T> *root,
+                                  BasicTreeArena<T> &arena) {
+    TREE_PROFILE_SCOPE("TreeOperations::mirror");
+    return mirrorInto(root, [&arena](T val) { return arena.create(val); });
+  }
+
+  // ---- Mirrored views ------------------------------------------------------
+  // BasicTreeView(root).mirror() is the O(1) mirror and shares every node.
+  // Mirroring keeps the shape and the values, so only the BST check sees
+  // a difference; everything else can be asked of view.node(). Copy a
+  // view only when the copy is going to be changed.
+
+  template <typename T> static bool isBST(BasicTreeView<T> view) {
+    if (!view.mirrored())
+      return isBST(view.node());
+    TREE_PROFILE_SCOPE("TreeOperations::isBST[view]");
+    // The mirror's inorder is the stored one reversed
+    bool first = true;
+    T prev{};
+    return TreeTraversals::forEachInorder(view.node(), [&](T val) {
+      bool ok = first || val < prev;
+      first = false;
+      prev = val;
+      return ok;
+    });
+  }
+
+  template <typename T>
+  static BasicTreeStats<T> stats(BasicTreeView<T> view) {
+    BasicTreeStats<T> result = stats(view.node());
+    if (view.mirrored())
+      result.isBST = isBST(view);
+    return result;
+  }
+
+  // The tree as the view shows it, as nodes of its own
+  template <typename T> static BasicTreeNode<T> *copy(BasicTreeView<T> view) {
+    return copyInto(view, [](T val) { return new BasicTreeNode<T>(val); });
+  }
+
+  template <typename T>
+  static BasicTreeNode<T> *copy(BasicTreeView<T> view,
+                                BasicTreeArena<T> &arena) {
+    return copyInto(view, [&arena](T val) { return arena.create(val); });
+  }
+
+  template <typename T>
+  static BasicTreeNode<T> *invert(BasicTreeNode<T> *root) {
+    TREE_PROFILE_SCOPE("TreeOperations::invert");
+    if (!root)
+      return nullptr;
+    auto &stack = scratchStack<BasicTreeNode<T> *>();
+    stack.push_back(root);
+    while (!stack.empty()) {
+      BasicTreeNode<T> *node = stack.back();
+      stack.pop_back();
+      std::swap(node->left, node->right);
+      if (node->left)
+        stack.push_back(node->left);
+      if (node->right)
+        stack.push_back(node->right);
+    }
+    return root;
+  }
+
+  // Rotate left children up until the root has none, then free it and
+  // continue with its right subtree: O(1) extra memory at any depth
+  template <typename T>
+  static void deleteTree(BasicTreeNode<T> *root) {
+    while (root) {
+      if (BasicTreeNode<T> *left = root->left) {
+        root->left = left->right;
+        left->right = root;
+        root = left;
+      } else {
+        BasicTreeNode<T> *right = root->right;
+        delete root;
+        root = right;
+      }
+    }
+  }
+
+  // ---- FlatTree versions -------------------------------------------------
+  // Same results as the pointer versions above. Children always sit after
+  // their parent, so a reverse sweep over the arrays visits every subtree
+  // before its root and needs no recursion. sum, minValue, maxValue and
+  // countLeaves are plain array reductions and run on VectorKernels.
+
+  static int height(const FlatTree &tree) {
+    TREE_PROFILE_SCOPE("TreeOperations::height[flat]");
+    TREE_PROFILE_NODES(tree.size());
+    return tree.levels();
+  }
+
+  static int countNodes(const FlatTree &tree) {
+    TREE_PROFILE_SCOPE("TreeOperations::countNodes[flat]");
+    TREE_PROFILE_NODES(tree.size());
+    return static_cast<int>(tree.size());
+  }
+
+  static int countLeaves(const FlatTree &tree) {
+    TREE_PROFILE_SCOPE("TreeOperations::countLeaves[flat]");
+    TREE_PROFILE_NODES(tree.size());
+    return static_cast<int>(VectorKernels::best().countLeaves(
+        tree.leftIndices().data(), tree.rightIndices().data(), tree.size()));
+  }
+
+  static long long sum(const FlatTree &tree) {
+    TREE_PROFILE_SCOPE("TreeOperations::sum[flat]");
+    TREE_PROFILE_NODES(tree.size());
+    return VectorKernels::best().sum(tree.values().data(), tree.size());
+  }
+
+  static int minValue(const FlatTree &tree) {
+    TREE_PROFILE_SCOPE("TreeOperations::minValue[flat]");
+    TREE_PROFILE_NODES(tree.size());
+    return VectorKernels::best().min(tree.values().data(), tree.size());
+  }
+
+  static int maxValue(const FlatTree &tree) {
+    TREE_PROFILE_SCOPE("TreeOperations::maxValue[flat]");
+    TREE_PROFILE_NODES(tree.size());
+    return VectorKernels::best().max(tree.values().data(), tree.size());
+  }
+
+  static int diameter(const FlatTree &tree) {
+    TREE_PROFILE_SCOPE("TreeOperations::diameter[flat]");
+    TREE_PROFILE_NODES(tree.size());
+    std::vector<uint32_t> heights(tree.size());
+    int result = 0;
+    for (size_t i = tree.size(); i-- > 0;) {
+      uint32_t left = childHeight(tree.left(i), heights);
+      uint32_t right = childHeight(tree.right(i), heights);
+      result = std::max(result, static_cast<int>(left + right));
+      heights[i] = 1 + std::max(left, right);
+    }
+    return result;
+  }
+
+  static bool isBalanced(const FlatTree &tree) {
+    TREE_PROFILE_SCOPE("TreeOperations::isBalanced[flat]");
+    TREE_PROFILE_NODES(tree.size());
+    std::vector<uint32_t> heights(tree.size());
+    for (size_t i = tree.size(); i-- > 0;) {
+      uint32_t left = childHeight(tree.left(i), heights);
+      uint32_t right = childHeight(tree.right(i), heights);
+      if (std::max(left, right) - std::min(left, right) > 1)
+        return false;
+      heights[i] = 1 + std::max(left, right);
+    }
+    return true;
+  }
+
+  // Inorder walk with an explicit stack: values must strictly increase
+  static bool isBST(const FlatTree &tree) {
+    TREE_PROFILE_SCOPE("TreeOperations::isBST[flat]");
+    TREE_PROFILE_NODES(tree.size());
+    auto &stack = scratchStack<uint32_t>();
+    bool havePrev = false;
+    int prev = 0;
+    uint32_t node = tree.empty() ? FlatTree::npos : 0;
+    while (node != FlatTree::npos || !stack.empty()) {
+      while (node != FlatTree::npos) {
+        stack.push_back(node);
+        node = tree.left(node);
+      }
+      node = stack.back();
+      stack.pop_back();
+      if (havePrev && tree.value(node) <= prev)
+        return false;
+      prev = tree.value(node);
+      havePrev = true;
+      node = tree.right(node);
+    }
+    return true;
+  }
+
+private:
+  static uint32_t childHeight(uint32_t child,
+                              const std::vector<uint32_t> &heights) {
+    return child == FlatTree::npos ? 0 : heights[child];
+  }
+
+  // Post-order fold: combine(node, leftResult, rightResult), with empty
+  // standing in for a missing child. Recurses while the tree is shallow
+  // and finishes deeper subtrees on an explicit stack.
+  template <typename T, typename R, typename Combine>
+  static R fold(BasicTreeNode<T> *root, R empty, Combine &&combine) {
+    return foldRecursive(root, empty, combine, 0);
+  }
+
+  template <typename T, typename R, typename Combine>
+  static R foldRecursive(BasicTreeNode<T> *root, const R &empty,
+                         Combine &combine, int depth) {
+    if (!root)
+      return empty;
+    if (depth > kMaxRecursionDepth)
+      return foldIterative(root, empty, combine);
+    R left = foldRecursive(root->left, empty, combine, depth + 1);
+    R right = foldRecursive(root->right, empty, combine, depth + 1);
+    return combine(root, left, right);
+  }
+
+  template <typename T> struct FoldFrame {
+    BasicTreeNode<T> *node;
+    bool expanded; // Children already pushed
+  };
+
+  template <typename T, typename R, typename Combine>
+  static R foldIterative(BasicTreeNode<T> *root, const R &empty,
+                         Combine &combine) {
+    if (!root)
+      return empty;
+    auto &frames = scratchStack<FoldFrame<T>>();
+    auto &results = scratchStack<R>();
+    frames.push_back({root, false});
+
+    while (!frames.empty()) {
+      BasicTreeNode<T> *node = frames.back().node;
+      if (!frames.back().expanded) {
+        frames.back().expanded = true;
+        if (node->right)
+          frames.push_back({node->right, false});
+        if (node->left)
+          frames.push_back({node->left, false});
+        continue;
+      }
+      frames.pop_back();
+
+      // The left result was pushed first, so the right one is on top
+      R right = empty, left = empty;
+      if (node->right) {
+        right = results.back();
+        results.pop_back();
+      }
+      if (node->left) {
+        left = results.back();
+        results.pop_back();
+      }
+      results.push_back(combine(node, left, right));
+    }
+    return results.back();
+  }
+
+  // BST bounds are exclusive and point at an ancestor's value. A null
+  // bound is open, so every value of T, extremes included, can fit.
+  template <typename T>
+  static bool outside(const T &val, const T *minVal, const T *maxVal) {
+    return (minVal && !(*minVal < val)) || (maxVal && !(val < *maxVal));
+  }
+
+  template <typename T>
+  static bool isBSTHelper(BasicTreeNode<T> *root, const T *minVal,
+                          const T *maxVal, int depth) {
+    if (!root)
+      return true;
+    if (depth > kMaxRecursionDepth)
+      return isBSTIterative(root, minVal, maxVal);
+    if (outside(root->val, minVal, maxVal))
+      return false;
+    return isBSTHelper(root->left, minVal, &root->val, depth + 1) &&
+           isBSTHelper(root->right, &root->val, maxVal, depth + 1);
+  }
+
+  template <typename T> struct BoundsFrame {
+    BasicTreeNode<T> *node;
+    const T *minVal, *maxVal;
+  };
+
+  template <typename T>
+  static bool isBSTWithin(BasicTreeNode<T> *root, const T *minVal,
+                          const T *maxVal) {
+    return isBSTHelper(root, minVal, maxVal, 0);
+  }
+
+  template <typename T>
+  static bool isBSTIterative(BasicTreeNode<T> *root, const T *minVal,
+                             const T *maxVal) {
+    auto &stack = scratchStack<BoundsFrame<T>>();
+    if (root)
+      stack.push_back({root, minVal, maxVal});
+    while (!stack.empty()) {
+      BoundsFrame<T> f = stack.back();
+      stack.pop_back();
+      if (outside(f.node->val, f.minVal, f.maxVal))
+        return false;
+      if (f.node->right)
+        stack.push_back({f.node->right, &f.node->val, f.maxVal});
+      if (f.node->left)
+        stack.push_back({f.node->left, f.minVal, &f.node->val});
+    }
+    return true;
+  }
+
+  template <typename T>
+  static bool boundsAboveCut(BasicTreeNode<T> *node, const T *minVal,
+                             const T *maxVal, int depth, int cutDepth,
+                             std::vector<BoundsFrame<T>> &subtrees) {
+    if (!node)
+      return true;
+    if (depth == cutDepth) {
+      subtrees.push_back({node, minVal, maxVal});
+      return true;
+    }
+    if (outside(node->val, minVal, maxVal))
+      return false;
+    return boundsAboveCut(node->left, minVal, &node->val, depth + 1,
+                          cutDepth, subtrees) &&
+           boundsAboveCut(node->right, &node->val, maxVal, depth + 1,
+                          cutDepth, subtrees);
+  }
+
+  // Parallel reduction: each subtree below the cut becomes one task, and
+  // the nodes above it are folded in by the calling thread
+  template <typename T, typename R, typename PerNode, typename PerSubtree,
+            typename Combine>
+  static R reduce(BasicTreeNode<T> *root, TreeExecutor &exec, R identity,
+                  PerNode &&perNode, PerSubtree &&perSubtree,
+                  Combine &&combine) {
+    if (exec.threadCount() == 1)
+      return root ? perSubtree(root) : identity;
+
+    BasicTreeSplit<T> split(root, TreeSplit::wantedFor(exec));
+    std::vector<R> partial(split.subtrees.size(), identity);
+    exec.parallelFor(split.subtrees.size(), [&](size_t i) {
+      partial[i] = perSubtree(split.subtrees[i]);
+    });
+
+    R result = identity;
+    for (BasicTreeNode<T> *node : split.top)
+      result = combine(result, perNode(node));
+    for (const R &r : partial)
+      result = combine(result, r);
+    return result;
+  }
+
+  // Copy with left and right swapped, built top-down from an explicit stack
+  template <typename T, typename NewNode>
+  static BasicTreeNode<T> *mirrorInto(BasicTreeNode<T> *root,
+                                      NewNode &&makeNode) {
+    return copyInto(BasicTreeView<T>(root, true), makeNode);
+  }
+
+  // Copy of what a view shows, built top-down from an explicit stack
+  template <typename T, typename NewNode>
+  static BasicTreeNode<T> *copyInto(BasicTreeView<T> view,
+                                    NewNode &&makeNode) {
+    if (!view)
+      return nullptr;
+    using Node = BasicTreeNode<T>;
+    auto &stack = scratchStack<std::pair<Node *, Node *>>();
+    Node *copy = makeNode(view.val());
+    stack.push_back({view.node(), copy});
+    bool mirrored = view.mirrored();
+    while (!stack.empty()) {
+      auto [src, dst] = stack.back();
+      stack.pop_back();
+      Node *left = mirrored ? src->right : src->left;
+      Node *right = mirrored ? src->left : src->right;
+      if (left) {
+        dst->left = makeNode(left->val);
+        stack.push_back({left, dst->left});
+      }
+      if (right) {
+        dst->right = makeNode(right->val);
+        stack.push_back({right, dst->right});
+      }
+    }
+    return copy;
+  }
+};
+
+// ============================================================================
+// Cached Tree (augmented nodes with per-subtree metrics)
+// ============================================================================
+
+// A private copy of a tree in which every node keeps the TreeStats of its
+// subtree. Queries read the root's entry in O(1) and match
+// TreeOperations::stats exactly. Edits go through paths of L and R steps
+// from the root, as in TreeViewport, and refresh only the entries on the
+// way back up, so each costs O(depth) rather than O(n).
+class CachedTree {
+public:
+  CachedTree() = default;
+  explicit CachedTree(TreeNode *root) { assign(root); }
+
+  // Nodes stay where they are when the deque moves, so moving is safe;
+  // copying would leave the parent links pointing into the source
+  CachedTree(const CachedTree &) = delete;
+  CachedTree &operator=(const CachedTree &) = delete;
+  CachedTree(CachedTree &&) = default;
+  CachedTree &operator=(CachedTree &&) = default;
+
+  // Replace the contents with a copy of root, in O(n)
+  void assign(TreeNode *root) {
+    clear();
+    if (!root)
+      return;
+    auto &stack = scratchStack<std::pair<TreeNode *, Node *>>();
+    top = make(root->val, nullptr);
+    stack.push_back({root, top});
+    std::vector<Node *> order; // Parents before children
+    while (!stack.empty()) {
+      auto [src, dst] = stack.back();
+      stack.pop_back();
+      order.push_back(dst);
+      if (src->left) {
+        dst->left = make(src->left->val, dst);
+        stack.push_back({src->left, dst->left});
+      }
+      if (src->right) {
+        dst->right = make(src->right->val, dst);
+        stack.push_back({src->right, dst->right});
+      }
+    }
+    for (size_t i = order.size(); i-- > 0;)
+      pull(order[i]);
+  }
+
+  void clear() {
+    nodes.clear();
+    freeNodes.clear();
+    top = nullptr;
+  }
+
+  bool empty() const { return !top; }
+
+  // ---- O(1) queries -------------------------------------------------------
+
+  const TreeStats &stats() const { return top ? top->stats : kEmpty; }
+  int height() const { return stats().height; }
+  int countNodes() const { return stats().nodeCount; }
+  int countLeaves() const { return stats().leafCount; }
+  long long sum() const { return stats().sum; }
+  int minValue() const { return stats().minValue; }
+  int maxValue() const { return stats().maxValue; }
+  int diameter() const { return stats().diameter; }
+  bool isBST() const { return stats().isBST; }
+  bool isBalanced() const { return stats().isBalanced; }
+
+  // ---- O(depth) edits -----------------------------------------------------
+  // Each returns false, changing nothing, when the path leads off the tree.
+  // A step other than L or R throws std::invalid_argument.
+
+  bool setValue(std::string_view path, int val) {
+    Node *node = find(path);
+    if (!node)
+      return false;
+    node->val = val;
+    refresh(node);
+    return true;
+  }
+
+  // Add a leaf in the empty slot the path names: the path without its
+  // last step must reach a node, and that step must lead nowhere yet.
+  // The empty path names the root of an empty tree.
+  bool insert(std::string_view path, int val) {
+    if (path.empty()) {
+      if (top)
+        return false;
+      top = make(val, nullptr);
+      pull(top);
+      return true;
+    }
+    Node *parent = find(path.substr(0, path.size() - 1));
+    if (!parent)
+      return false;
+    pushDown(parent);
+    Node *&slot = isLeft(path.back()) ? parent->left : parent->right;
+    if (slot)
+      return false;
+    slot = make(val, parent);
+    pull(slot);
+    refresh(parent);
+    return true;
+  }
+
+  // Remove the subtree at path; its nodes are reused by later inserts
+  bool erase(std::string_view path) {
+    Node *node = find(path);
+    if (!node)
+      return false;
+    Node *parent = node->parent;
+    if (!parent)
+      top = nullptr;
+    else if (parent->left == node)
+      parent->left = nullptr;
+    else
+      parent->right = nullptr;
+
+    auto &stack = scratchStack<Node *>();
+    stack.push_back(node);
+    while (!stack.empty()) {
+      Node *n = stack.back();
+      stack.pop_back();
+      if (n->left)
+        stack.push_back(n->left);
+      if (n->right)
+        stack.push_back(n->right);
+      freeNodes.push_back(n);
+    }
+    if (parent)
+      refresh(parent);
+    return true;
+  }
+
+  // Mirror the subtree at path. Nothing below it is touched: the node is
+  // tagged, and the swap moves down a level whenever a later walk passes.
+  bool invert(std::string_view path = {}) {
+    Node *node = find(path);
+    if (!node)
+      return false;
+    flip(node);
+    if (node->parent)
+      refresh(node->parent);
+    return true;
+  }
+
+  // ---- Export -------------------------------------------------------------
+
+  // Linked copy with every pending mirror applied, in O(n)
+  TreeNode *toTree(TreeArena &arena) const {
+    if (!top)
+      return nullptr;
+    // The flag says the subtree is mirrored by an odd number of pending tags
+    struct Frame {
+      const Node *src;
+      TreeNode *dst;
+      bool mirrored;
+    };
+    auto &stack = scratchStack<Frame>();
+    TreeNode *copy = arena.create(top->val);
+    stack.push_back({top, copy, false});
+    while (!stack.empty()) {
+      Frame f = stack.back();
+      stack.pop_back();
+      bool swapped = f.mirrored != f.src->flip;
+      const Node *left = swapped ? f.src->right : f.src->left;
+      const Node *right = swapped ? f.src->left : f.src->right;
+      if (left) {
+        f.dst->left = arena.create(left->val);
+        stack.push_back({left, f.dst->left, swapped});
+      }
+      if (right) {
+        f.dst->right = arena.create(right->val);
+        stack.push_back({right, f.dst->right, swapped});
+      }
+    }
+    return copy;
+  }
+
+private:
+  struct Node {
+    int val;
+    Node *left, *right, *parent;
+    TreeStats stats;         // Of this subtree, pending mirrors included
+    bool reverseBST = true;  // Strictly decreasing inorder: BST if mirrored
+    bool flip = false;       // Children still to be swapped and tagged
+  };
+
+  static inline const TreeStats kEmpty{};
+
+  static bool isLeft(char step) {
+    if (step == 'L' || step == 'l')
+      return true;
+    if (step == 'R' || step == 'r')
+      return false;
+    throw std::invalid_argument("CachedTree: path steps are L or R");
+  }
+
+  Node *make(int val, Node *parent) {
+    Node *node;
+    if (!freeNodes.empty()) {
+      node = freeNodes.back();
+      freeNodes.pop_back();
+    } else {
+      node = &nodes.emplace_back();
+    }
+    *node = Node{val, nullptr, nullptr, parent, TreeStats(), true, false};
+    return node;
+  }
+
+  // Walk the path, settling pending mirrors on the way so the steps mean
+  // what the caller sees
+  Node *find(std::string_view path) {
+    Node *node = top;
+    for (char step : path) {
+      if (!node)
+        return nullptr;
+      pushDown(node);
+      node = isLeft(step) ? node->left : node->right;
+    }
+    return node;
+  }
+
+  // Mirroring keeps every metric but swaps BST for reverse BST
+  static void flip(Node *node) {
+    node->flip = !node->flip;
+    std::swap(node->stats.isBST, node->reverseBST);
+  }
+
+  static void pushDown(Node *node) {
+    if (!node->flip)
+      return;
+    node->flip = false;
+    std::swap(node->left, node->right);
+    if (node->left)
+      flip(node->left);
+    if (node->right)
+      flip(node->right);
+  }
+
+  // Recompute one node from its children, as TreeOperations::stats does.
+  // Its own pending mirror is settled first so the children are in place.
+  static void pull(Node *node) {
+    pushDown(node);
+    const TreeStats &left = node->left ? node->left->stats : kEmpty;
+    const TreeStats &right = node->right ? node->right->stats : kEmpty;
+    int val = node->val;
+    node->stats = TreeStats::combine(val, left, right);
+    node->reverseBST = (!node->left || node->left->reverseBST) &&
+                       (!node->right || node->right->reverseBST) &&
+                       (!left.nodeCount || val < left.minValue) &&
+                       (!right.nodeCount || right.maxValue < val);
+  }
+
+  // Recompute node and every ancestor
+  void refresh(Node *node) {
+    for (; node; node = node->parent)
+      pull(node);
+  }
+
+  std::deque<Node> nodes;
+  std::vector<Node *> freeNodes;
+  Node *top = nullptr;
+};
+
+// ============================================================================
+// Tree Snapshots (immutable trees shared between threads)
+// ============================================================================
+
+// A tree that never changes after it is built, with its nodes in its own
+// arena. Snapshots travel as TreeSnapshot::Ptr, and any number of threads
+// may read one at once through every TreeTraversals, TreeOperations and
+// TreeVisualizer call, none of which writes to the nodes. The exceptions
+// are TreeOperations::invert and deleteTree, which must never see a
+// snapshot, and a SubtreeSizes cache, which belongs to one thread.
+class TreeSnapshot {
+public:
+  using Ptr = std::shared_ptr<const TreeSnapshot>;
+
+  // Parse a LeetCode string; throws like Codec::deserialize
+  static Ptr parse(std::string_view data) {
+    std::unique_ptr<TreeSnapshot> snapshot(new TreeSnapshot());
+    snapshot->top = Codec::deserialize(data, snapshot->arena);
+    return snapshot;
+  }
+
+  // Strict parse; nullptr, with status filled in, on bad input
+  static Ptr parse(std::string_view data, Codec::ParseStatus &status) {
+    std::unique_ptr<TreeSnapshot> snapshot(new TreeSnapshot());
+    snapshot->top = Codec::deserialize(data, snapshot->arena, status);
+    if (!status.ok)
+      return nullptr;
+    return snapshot;
+  }
+
+  // Freeze a copy of what view shows
+  static Ptr copyOf(TreeView view) {
+    std::unique_ptr<TreeSnapshot> snapshot(new TreeSnapshot());
+    snapshot->top = TreeOperations::copy(view, snapshot->arena);
+    return snapshot;
+  }
+
+  static const Ptr &empty() {
+    static const Ptr none(new TreeSnapshot());
+    return none;
+  }
+
+  // Read-only by contract: the node type has no const form to enforce it
+  TreeNode *root() const { return top; }
+  TreeView view() const { return TreeView(top); }
+
+private:
+  TreeSnapshot() = default;
+
+  TreeArena arena;
+  TreeNode *top = nullptr;
+};
+
+// The current snapshot of a tree that is being replaced while it is read.
+// publish() swaps in a new snapshot atomically, and an old snapshot is
+// freed as soon as the last reader holding it lets go. Nothing takes a
+// lock. The store keeps one 64-bit word: a pointer to a Slot holding the
+// current Ptr, with a count of readers borrowing that slot in the top 16
+// bits. A reader bumps the count, copies the Ptr and gives the borrow
+// back. publish() swaps the word and hands any borrows still out to the
+// old slot, whose last borrower deletes it. Slot addresses must fit in
+// 48 bits, as user-space addresses do on x86-64 and AArch64.
+class TreeStore {
+public:
+  TreeStore() : word(pack(new Slot{TreeSnapshot::empty()})) {}
+
+  ~TreeStore() { delete unpack(word.load(std::memory_order_acquire)); }
+
+  TreeStore(const TreeStore &) = delete;
+  TreeStore &operator=(const TreeStore &) = delete;
+
+  void publish(TreeSnapshot::Ptr next) {
+    if (!next)
+      next = TreeSnapshot::empty();
+    uint64_t old = word.exchange(pack(new Slot{std::move(next)}),
+                                 std::memory_order_acq_rel);
+    retire(unpack(old), static_cast<int64_t>(old >> kCountShift));
+    version.fetch_add(1, std::memory_order_release);
+  }
+
+  // An owning reference to the latest snapshot
+  TreeSnapshot::Ptr current() const {
+    uint64_t borrowed = word.fetch_add(kOneBorrow, std::memory_order_acquire);
+    Slot *slot = unpack(borrowed);
+    TreeSnapshot::Ptr snapshot = slot->snapshot;
+
+    // Give the borrow back to the word, or to the slot once it is retired
+    uint64_t now = word.load(std::memory_order_relaxed);
+    while (unpack(now) == slot)
+      if (word.compare_exchange_weak(now, now - kOneBorrow,
+                                     std::memory_order_release,
+                                     std::memory_order_relaxed))
+        return snapshot;
+    retire(slot, -1);
+    return snapshot;
+  }
+
+  // One per reading thread. get() keeps returning the snapshot it holds
+  // until a newer one is published, so steady-state reads cost one load of
+  // the version counter instead of a shared reference count update that
+  // every core would contend on. The held snapshot stays alive until the
+  // next get() that sees a newer one, or until the Reader goes away.
+  class Reader {
+  public:
+    explicit Reader(const TreeStore &store) : store(&store) {}
+
+    const TreeSnapshot &get() {
+      uint64_t latest = store->version.load(std::memory_order_acquire);
+      if (!held || latest != seen) {
+        held = store->current();
+        seen = latest;
+      }
+      return *held;
+    }
+
+  private:
+    const TreeStore *store;
+    TreeSnapshot::Ptr held;
+    uint64_t seen = 0;
+  };
+
+private:
+  struct Slot {
+    TreeSnapshot::Ptr snapshot;
+    std::atomic<int64_t> borrows{0}; // Handed over, minus given back
+  };
+
+  static constexpr int kCountShift = 48;
+  static constexpr uint64_t kOneBorrow = uint64_t(1) << kCountShift;
+  static constexpr uint64_t kPointerMask = kOneBorrow - 1;
+
+  static uint64_t pack(Slot *slot) {
+    uint64_t bits = reinterpret_cast<uintptr_t>(slot);
+    if (bits & ~kPointerMask) {
+      delete slot;
+      throw std::runtime_error("TreeStore: address does not fit in 48 bits");
+    }
+    return bits;
+  }
+  static Slot *unpack(uint64_t bits) {
+    return reinterpret_cast<Slot *>(
+        static_cast<uintptr_t>(bits & kPointerMask));
+  }
+
+  // Add to a detached slot's borrows; whoever brings them to 0 frees it
+  static void retire(Slot *slot, int64_t borrows) {
+    if (slot->borrows.fetch_add(borrows, std::memory_order_acq_rel) +
+            borrows ==
+        0)
+      delete slot;
+  }
+
+  mutable std::atomic<uint64_t> word;
+  std::atomic<uint64_t> version{0};
+};
+
+// ============================================================================
+// Subtree Interning (hash-consed DAG)
+// ============================================================================
+
+// Every distinct subtree stored once. A subtree is keyed on its value and
+// the ids of its two children, so equal ids mean equal subtrees, and the
+// key is a Merkle hash that needs only one lookup per node. Ids are dense
+// and children always come before their parents. Any number of trees may
+// be interned into one TreeDag and then share their common subtrees.
+//
+// The TreeStats of each distinct subtree are computed once, when it is
+// first interned, so stats(id) costs O(1) however often that subtree
+// repeats. That is the only memoised query. toTree() rebuilds a tree in
+// which repeated subtrees are the same nodes, saving memory but not time:
+// a traversal or render of it still visits a shared node once for every
+// place it occurs, O(n) in the expanded tree. It works with every
+// read-only TreeTraversals, TreeOperations and TreeVisualizer call and
+// must never reach invert or deleteTree.
+class TreeDag {
+public:
+  using Id = uint32_t;
+  static constexpr Id npos = UINT32_MAX; // The empty subtree
+
+  // Id of the subtree val(left, right), creating it if it is new
+  Id intern(int val, Id left, Id right) {
+    auto [it, added] = index.try_emplace(Key{val, left, right}, 0);
+    if (!added)
+      return it->second;
+    if (entries.size() >= npos)
+      throw std::length_error("TreeDag: too many subtrees");
+    it->second = static_cast<Id>(entries.size());
+    entries.push_back(
+        {val, left, right, TreeStats::combine(val, stats(left), stats(right))});
+    return it->second;
+  }
+
+  // Intern a whole tree bottom-up; npos for an empty one
+  Id intern(TreeView root) {
+    if (!root)
+      return npos;
+    struct Frame {
+      TreeView node;
+      bool expanded;
+    };
+    std::vector<Frame> stack = {{root, false}};
+    std::vector<Id> ids; // Finished subtrees, left before right
+    while (!stack.empty()) {
+      Frame frame = stack.back();
+      stack.pop_back();
+      TreeView node = frame.node;
+      if (!frame.expanded) {
+        stack.push_back({node, true});
+        if (TreeView right = node.right())
+          stack.push_back({right, false});
+        if (TreeView left = node.left())
+          stack.push_back({left, false});
+        continue;
+      }
+      Id right = node.right() ? pop(ids) : npos;
+      Id left = node.left() ? pop(ids) : npos;
+      ids.push_back(intern(node.val(), left, right));
+    }
+    return ids.back();
+  }
+
+  Id intern(const FlatTree &tree) {
+    return tree.empty() ? npos : internNodes(tree)[0];
+  }
+
+  // Id of the subtree under every node of tree, by BFS index. Two nodes
+  // hold equal subtrees exactly when their ids match.
+  std::vector<Id> internNodes(const FlatTree &tree) {
+    std::vector<Id> ids(tree.size());
+    index.reserve(index.size() + tree.size());
+    auto idOf = [&ids](uint32_t child) {
+      return child == FlatTree::npos ? npos : ids[child];
+    };
+    // Children have larger indices than their parents
+    for (size_t i = tree.size(); i-- > 0;) {
+      uint32_t node = static_cast<uint32_t>(i);
+      ids[i] = intern(tree.value(node), idOf(tree.left(node)),
+                      idOf(tree.right(node)));
+    }
+    return ids;
+  }
+
+  void clear() {
+    entries.clear();
+    index.clear();
+  }
+
+  // Distinct subtrees interned so far
+  size_t size() const { return entries.size(); }
+
+  int value(Id id) const { return entries[id].val; }
+  Id left(Id id) const { return entries[id].left; }
+  Id right(Id id) const { return entries[id].right; }
+
+  // Everything TreeOperations::stats reports for the subtree, in O(1)
+  const TreeStats &stats(Id id) const {
+    return id == npos ? kEmpty : entries[id].stats;
+  }
+
+  // How many times each subtree occurs in the tree under root, indexed by
+  // id; O(root) time, not O(nodes in the tree)
+  std::vector<uint64_t> occurrences(Id root) const {
+    if (root == npos)
+      return {};
+    std::vector<uint64_t> counts(size_t(root) + 1);
+    counts[root] = 1;
+    for (size_t id = root + 1; id-- > 0;) {
+      if (!counts[id])
+        continue;
+      const Entry &e = entries[id];
+      if (e.left != npos)
+        counts[e.left] += counts[id];
+      if (e.right != npos)
+        counts[e.right] += counts[id];
+    }
+    return counts;
+  }
+
+  // Subtrees that occur more than once under root, each listed once,
+  // children before parents (LeetCode "Find Duplicate Subtrees")
+  std::vector<Id> duplicates(Id root) const {
+    std::vector<uint64_t> counts = occurrences(root);
+    std::vector<Id> result;
+    for (size_t id = 0; id < counts.size(); id++)
+      if (counts[id] > 1)
+        result.push_back(static_cast<Id>(id));
+    return result;
+  }
+
+  // Build the subtree in the arena with one node per distinct subtree
+  TreeNode *toTree(Id root, TreeArena &arena) const {
+    if (root == npos)
+      return nullptr;
+    std::vector<uint64_t> counts = occurrences(root);
+    std::vector<TreeNode *> nodes(counts.size(), nullptr);
+    auto nodeOf = [&nodes](Id id) { return id == npos ? nullptr : nodes[id]; };
+    for (size_t id = 0; id < counts.size(); id++) {
+      if (!counts[id])
+        continue;
+      const Entry &e = entries[id];
+      nodes[id] = arena.create(e.val, nodeOf(e.left), nodeOf(e.right));
+    }
+    return nodes[root];
+  }
+
+private:
+  struct Key {
+    int val;
+    Id left, right;
+    bool operator==(const Key &other) const {
+      return val == other.val && left == other.left && right == other.right;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key &key) const {
+      uint64_t h = static_cast<uint32_t>(key.val);
+      h = h * 0x9e3779b97f4a7c15ULL + key.left;
+      h = h * 0x9e3779b97f4a7c15ULL + key.right;
+      return static_cast<size_t>(h ^ (h >> 29));
+    }
+  };
+
+  struct Entry {
+    int val;
+    Id left, right;
+    TreeStats stats;
+  };
 
-    std::cout << prefix << (isLeft ? "└── " : "┌── ") << root->val << "\n";
+  static inline const TreeStats kEmpty{};
 
-    if (root->left) {
-      printCompact(root->left, prefix + (isLeft ? "    " : "│   "), true);
-    }
+  static Id pop(std::vector<Id> &ids) {
+    Id id = ids.back();
+    ids.pop_back();
+    return id;
   }
+
+  std::vector<Entry> entries;
+  std::unordered_map<Key, Id, KeyHash> index;
 };
 
 // ============================================================================
-// Tree Traversals
+// Ancestor Queries (LCA, distance, k-th ancestor)
 // ============================================================================
 
-class TreeTraversals {
+// Ancestry questions about a FlatTree, answered without walking the tree.
+// Nodes are named by their FlatTree index. Building takes O(n log n): one
+// preorder pass gives every node its depth and the interval of preorder
+// positions its subtree covers, and a sparse table over the preorder finds
+// the shallowest node in any range. The tree may change afterwards; the
+// index describes it as it was when built.
+//
+//   lca, distance, contains, depth, parent   O(1)
+//   kthAncestor                              O(log n)
+//   path                                     O(length of the path)
+class TreeQueryIndex {
 public:
-  static std::vector<int> inorder(TreeNode *root) {
-    std::vector<int> result;
-    inorderHelper(root, result);
-    return result;
+  static constexpr uint32_t npos = FlatTree::npos;
+  using Query = std::pair<uint32_t, uint32_t>;
+
+  TreeQueryIndex() = default;
+  explicit TreeQueryIndex(const FlatTree &tree) { build(tree); }
+
+  void build(const FlatTree &tree) {
+    size_t n = tree.size();
+    parents.assign(n, npos);
+    depths.assign(n, 0);
+    enter.assign(n, 0);
+    leave.assign(n, 0);
+    table.clear();
+    byDepth.clear();
+    depthStart.clear();
+    if (n == 0)
+      return;
+
+    // Preorder positions and depths, with an explicit stack
+    std::vector<uint32_t> order;
+    order.reserve(n);
+    std::vector<uint32_t> &stack = scratchStack<uint32_t>();
+    stack.clear();
+    stack.push_back(0);
+    int maxDepth = 0;
+    while (!stack.empty()) {
+      uint32_t node = stack.back();
+      stack.pop_back();
+      enter[node] = static_cast<uint32_t>(order.size());
+      order.push_back(node);
+      maxDepth = std::max(maxDepth, depths[node]);
+      for (uint32_t child : {tree.right(node), tree.left(node)}) {
+        if (child == npos)
+          continue;
+        parents[child] = node;
+        depths[child] = depths[node] + 1;
+        stack.push_back(child);
+      }
+    }
+
+    // Subtree sizes, summed bottom-up over the preorder, end each interval
+    for (uint32_t i = 0; i < n; i++)
+      leave[i] = 1;
+    for (size_t pos = n; pos-- > 1;)
+      leave[parents[order[pos]]] += leave[order[pos]];
+    for (uint32_t i = 0; i < n; i++)
+      leave[i] += enter[i];
+
+    // Nodes of each depth in preorder, for kthAncestor
+    depthStart.assign(size_t(maxDepth) + 2, 0);
+    for (uint32_t node : order)
+      depthStart[depths[node] + 1]++;
+    for (size_t d = 1; d < depthStart.size(); d++)
+      depthStart[d] += depthStart[d - 1];
+    byDepth.resize(n);
+    std::vector<uint32_t> fill(depthStart.begin(), depthStart.end() - 1);
+    for (uint32_t node : order)
+      byDepth[fill[depths[node]]++] = node;
+
+    // table[k][i]: shallowest node among preorder positions [i, i + 2^k)
+    table.push_back(std::move(order));
+    for (size_t span = 2; span <= n; span *= 2) {
+      const std::vector<uint32_t> &prev = table.back();
+      std::vector<uint32_t> next(n - span + 1);
+      for (size_t i = 0; i < next.size(); i++)
+        next[i] = shallower(prev[i], prev[i + span / 2]);
+      table.push_back(std::move(next));
+    }
   }
 
-  static std::vector<int> preorder(TreeNode *root) {
-    std::vector<int> result;
-    preorderHelper(root, result);
-    return result;
+  size_t size() const { return parents.size(); }
+
+  uint32_t parent(uint32_t node) const { return parents[node]; }
+  int depth(uint32_t node) const { return depths[node]; }
+
+  // True when node lies in the subtree of ancestor, itself included
+  bool contains(uint32_t ancestor, uint32_t node) const {
+    return enter[ancestor] <= enter[node] && enter[node] < leave[ancestor];
   }
 
-  static std::vector<int> postorder(TreeNode *root) {
-    std::vector<int> result;
-    postorderHelper(root, result);
-    return result;
+  uint32_t lca(uint32_t a, uint32_t b) const {
+    if (a == b)
+      return a;
+    uint32_t from = std::min(enter[a], enter[b]);
+    uint32_t to = std::max(enter[a], enter[b]);
+    // The shallowest node after a's position and up to b's is the child
+    // of the LCA on the way to the later of the two
+    uint32_t len = to - from;
+    int k = 31 - __builtin_clz(len);
+    uint32_t top = shallower(table[k][from + 1], table[k][to + 1 - (1u << k)]);
+    return parents[top];
   }
 
-  static std::vector<std::vector<int>> levelOrder(TreeNode *root) {
-    std::vector<std::vector<int>> result;
-    if (!root)
-      return result;
+  // Edges between a and b, as TreeOperations::diameter counts them
+  int distance(uint32_t a, uint32_t b) const {
+    return depths[a] + depths[b] - 2 * depths[lca(a, b)];
+  }
 
-    std::queue<TreeNode *> q;
-    q.push(root);
+  // The ancestor k levels above node; node for k == 0, npos past the root
+  uint32_t kthAncestor(uint32_t node, uint32_t k) const {
+    if (k > static_cast<uint32_t>(depths[node]))
+      return npos;
+    // The last node at the target depth that starts before node does
+    size_t d = static_cast<size_t>(depths[node]) - k;
+    auto first = byDepth.begin() + depthStart[d];
+    auto last = byDepth.begin() + depthStart[d + 1];
+    auto it = std::upper_bound(
+        first, last, enter[node],
+        [this](uint32_t pos, uint32_t other) { return pos < enter[other]; });
+    return *(it - 1);
+  }
 
-    while (!q.empty()) {
-      int size = q.size();
-      std::vector<int> level;
+  // Nodes from a up to the LCA and down to b, both ends included
+  std::vector<uint32_t> path(uint32_t a, uint32_t b) const {
+    uint32_t top = lca(a, b);
+    std::vector<uint32_t> result;
+    for (uint32_t node = a; node != top; node = parents[node])
+      result.push_back(node);
+    result.push_back(top);
+    size_t mid = result.size();
+    for (uint32_t node = b; node != top; node = parents[node])
+      result.push_back(node);
+    std::reverse(result.begin() + mid, result.end());
+    return result;
+  }
 
-      for (int i = 0; i < size; i++) {
-        TreeNode *node = q.front();
-        q.pop();
-        level.push_back(node->val);
+  // ---- Batched queries ----------------------------------------------------
+  // One answer per query, in order. With an executor the queries are
+  // answered in blocks on every thread.
 
-        if (node->left)
-          q.push(node->left);
-        if (node->right)
-          q.push(node->right);
-      }
+  std::vector<uint32_t> lca(const std::vector<Query> &queries,
+                            TreeExecutor *exec = nullptr) const {
+    return answer<uint32_t>(queries, exec, [this](uint32_t a, uint32_t b) {
+      return lca(a, b);
+    });
+  }
 
-      result.push_back(level);
-    }
+  std::vector<int> distance(const std::vector<Query> &queries,
+                            TreeExecutor *exec = nullptr) const {
+    return answer<int>(queries, exec, [this](uint32_t a, uint32_t b) {
+      return distance(a, b);
+    });
+  }
 
-    return result;
+  // Queries are {node, k}
+  std::vector<uint32_t> kthAncestor(const std::vector<Query> &queries,
+                                    TreeExecutor *exec = nullptr) const {
+    return answer<uint32_t>(queries, exec, [this](uint32_t node, uint32_t k) {
+      return kthAncestor(node, k);
+    });
   }
 
 private:
-  static void inorderHelper(TreeNode *root, std::vector<int> &result) {
-    if (!root)
-      return;
-    inorderHelper(root->left, result);
-    result.push_back(root->val);
-    inorderHelper(root->right, result);
-  }
+  static constexpr size_t kBlock = 4096;
 
-  static void preorderHelper(TreeNode *root, std::vector<int> &result) {
-    if (!root)
-      return;
-    result.push_back(root->val);
-    preorderHelper(root->left, result);
-    preorderHelper(root->right, result);
+  uint32_t shallower(uint32_t a, uint32_t b) const {
+    return depths[b] < depths[a] ? b : a;
   }
 
-  static void postorderHelper(TreeNode *root, std::vector<int> &result) {
-    if (!root)
-      return;
-    postorderHelper(root->left, result);
-    postorderHelper(root->right, result);
-    result.push_back(root->val);
+  template <typename R, typename Fn>
+  static std::vector<R> answer(const std::vector<Query> &queries,
+                               TreeExecutor *exec, const Fn &fn) {
+    std::vector<R> results(queries.size());
+    auto run = [&](size_t block) {
+      size_t end = std::min(queries.size(), (block + 1) * kBlock);
+      for (size_t i = block * kBlock; i < end; i++)
+        results[i] = fn(queries[i].first, queries[i].second);
+    };
+    size_t blocks = (queries.size() + kBlock - 1) / kBlock;
+    if (exec)
+      exec->parallelFor(blocks, run);
+    else
+      for (size_t block = 0; block < blocks; block++)
+        run(block);
+    return results;
   }
+
+  std::vector<uint32_t> parents;
+  std::vector<int> depths;
+  std::vector<uint32_t> enter, leave; // Preorder interval of each subtree
+  std::vector<std::vector<uint32_t>> table;
+  std::vector<uint32_t> byDepth;   // Nodes by depth, then preorder
+  std::vector<size_t> depthStart;  // Depth d is [depthStart[d], [d + 1])
 };
 
 // ============================================================================
-// Tree Operations
+// BST Order Statistics
 // ============================================================================
 
-class TreeOperations {
+// Search, rank and range queries on a FlatTree that passes
+// TreeOperations::isBST, each in O(height). Every node carries the size
+// and sum of its left subtree, so a descent only ever reads the node it is
+// on, 24 bytes. The batch overloads walk kLanes queries down the tree side
+// by side, so the cache misses of one lane overlap with the others', and
+// spread blocks of queries over a TreeExecutor when given one. Results
+// name nodes by FlatTree index, or npos for none.
+class BSTIndex {
 public:
-  static int height(TreeNode *root) {
-    if (!root)
-      return 0;
-    return 1 + std::max(height(root->left), height(root->right));
+  static constexpr uint32_t npos = FlatTree::npos;
+  using Sum = TreeValue<int>::Sum;
+  using Range = std::pair<int, int>; // Closed: first <= value <= second
+
+  BSTIndex() = default;
+  explicit BSTIndex(const FlatTree &tree) { build(tree); }
+
+  // Throws std::invalid_argument unless the tree is a BST
+  void build(const FlatTree &tree) {
+    if (!TreeOperations::isBST(tree))
+      throw std::invalid_argument("BSTIndex: tree is not a BST");
+    size_t n = tree.size();
+    nodes.assign(n, Node());
+    std::vector<uint32_t> sizes(n);
+    std::vector<Sum> sums(n);
+    // Children come after their parents
+    for (size_t i = n; i-- > 0;) {
+      uint32_t at = static_cast<uint32_t>(i);
+      Node &node = nodes[i];
+      node.val = tree.value(at);
+      node.left = tree.left(at);
+      node.right = tree.right(at);
+      if (node.left != npos) {
+        node.leftSize = sizes[node.left];
+        node.leftSum = sums[node.left];
+      }
+      sizes[i] = 1 + node.leftSize;
+      sums[i] = node.val + node.leftSum;
+      if (node.right != npos) {
+        sizes[i] += sizes[node.right];
+        sums[i] += sums[node.right];
+      }
+    }
   }
 
-  static int countNodes(TreeNode *root) {
-    if (!root)
-      return 0;
-    return 1 + countNodes(root->left) + countNodes(root->right);
+  size_t size() const { return nodes.size(); }
+  int value(uint32_t node) const { return nodes[node].val; }
+
+  uint32_t find(int x) const {
+    uint32_t at = root();
+    while (at != npos && nodes[at].val != x)
+      at = x < nodes[at].val ? nodes[at].left : nodes[at].right;
+    return at;
   }
 
-  static int countLeaves(TreeNode *root) {
-    if (!root)
+  // How many values are below x
+  uint32_t rank(int x) const { return below<false>(x).count; }
+
+  // The k-th smallest value's node, counting from 1 as LeetCode does
+  uint32_t kthSmallest(uint32_t k) const {
+    if (k == 0 || k > size())
+      return npos;
+    for (uint32_t at = root();;) {
+      const Node &node = nodes[at];
+      if (k <= node.leftSize) {
+        at = node.left;
+      } else if (k == node.leftSize + 1) {
+        return at;
+      } else {
+        k -= node.leftSize + 1;
+        at = node.right;
+      }
+    }
+  }
+
+  // Largest value <= x, and smallest value >= x
+  uint32_t floor(int x) const { return bound(x, true); }
+  uint32_t ceil(int x) const { return bound(x, false); }
+
+  uint32_t rangeCount(Range range) const {
+    if (range.first > range.second)
       return 0;
-    if (!root->left && !root->right)
-      return 1;
-    return countLeaves(root->left) + countLeaves(root->right);
+    return below<true>(range.second).count - below<false>(range.first).count;
   }
 
-  static int sum(TreeNode *root) {
-    if (!root)
+  Sum rangeSum(Range range) const {
+    if (range.first > range.second)
       return 0;
-    return root->val + sum(root->left) + sum(root->right);
+    return below<true>(range.second).sum - below<false>(range.first).sum;
   }
 
-  static int minValue(TreeNode *root) {
-    if (!root)
-      return INT_MAX;
-    return std::min({root->val, minValue(root->left), minValue(root->right)});
+  // ---- Batched queries ----------------------------------------------------
+  // One answer per query, in order, matching the single-query calls.
+
+  std::vector<uint32_t> find(const std::vector<int> &xs,
+                             TreeExecutor *exec = nullptr) const {
+    std::vector<uint32_t> results(xs.size(), npos);
+    inBlocks(xs.size(), exec, [&](size_t begin, size_t end) {
+      descend(xs.data() + begin, results.data() + begin, end - begin,
+              [](int x, const Node &node, uint32_t at, uint32_t &found) {
+                if (x == node.val) {
+                  found = at;
+                  return npos;
+                }
+                return x < node.val ? node.left : node.right;
+              });
+    });
+    return results;
   }
 
-  static int maxValue(TreeNode *root) {
-    if (!root)
-      return INT_MIN;
-    return std::max({root->val, maxValue(root->left), maxValue(root->right)});
+  std::vector<uint32_t> rank(const std::vector<int> &xs,
+                             TreeExecutor *exec = nullptr) const {
+    std::vector<uint32_t> results(xs.size());
+    inBlocks(xs.size(), exec, [&](size_t begin, size_t end) {
+      std::vector<Below> found(end - begin);
+      belowAll<false>(xs.data() + begin, found.data(), end - begin);
+      for (size_t i = begin; i < end; i++)
+        results[i] = found[i - begin].count;
+    });
+    return results;
   }
 
-  static int diameter(TreeNode *root) {
-    int result = 0;
-    diameterHelper(root, result);
-    return result;
+  std::vector<uint32_t> rangeCount(const std::vector<Range> &ranges,
+                                   TreeExecutor *exec = nullptr) const {
+    std::vector<uint32_t> results(ranges.size());
+    inRanges(ranges, exec, [&](size_t i, const Below &lo, const Below &hi) {
+      results[i] = hi.count - lo.count;
+    });
+    return results;
   }
 
-  static bool isBalanced(TreeNode *root) { return balancedHeight(root) != -1; }
+  std::vector<Sum> rangeSum(const std::vector<Range> &ranges,
+                            TreeExecutor *exec = nullptr) const {
+    std::vector<Sum> results(ranges.size());
+    inRanges(ranges, exec, [&](size_t i, const Below &lo, const Below &hi) {
+      results[i] = hi.sum - lo.sum;
+    });
+    return results;
+  }
 
-  static bool isBST(TreeNode *root) {
-    return isBSTHelper(root, LONG_MIN, LONG_MAX);
+private:
+  static constexpr size_t kLanes = 16;
+  static constexpr size_t kBlock = 4096;
+
+  struct Node {
+    int val = 0;
+    uint32_t left = npos, right = npos;
+    uint32_t leftSize = 0;
+    Sum leftSum = 0;
+  };
+
+  // Values below x (or at most x), and their total
+  struct Below {
+    uint32_t count = 0;
+    Sum sum = 0;
+  };
+
+  uint32_t root() const { return nodes.empty() ? npos : 0; }
+
+  template <bool Inclusive>
+  static uint32_t stepBelow(int x, const Node &node, Below &acc) {
+    bool right = Inclusive ? node.val <= x : node.val < x;
+    if (!right)
+      return node.left;
+    acc.count += node.leftSize + 1;
+    acc.sum += node.leftSum + node.val;
+    return node.right;
   }
 
-  static TreeNode *mirror(TreeNode *root) {
-    if (!root)
-      return nullptr;
-    TreeNode *newNode = new TreeNode(root->val);
-    newNode->left = mirror(root->right);
-    newNode->right = mirror(root->left);
-    return newNode;
+  template <bool Inclusive> Below below(int x) const {
+    Below acc;
+    for (uint32_t at = root(); at != npos;)
+      at = stepBelow<Inclusive>(x, nodes[at], acc);
+    return acc;
   }
 
-  static TreeNode *invert(TreeNode *root) {
-    if (!root)
-      return nullptr;
-    std::swap(root->left, root->right);
-    invert(root->left);
-    invert(root->right);
-    return root;
+  template <bool Inclusive>
+  void belowAll(const int *xs, Below *out, size_t n) const {
+    descend(xs, out, n, [](int x, const Node &node, uint32_t, Below &acc) {
+      return stepBelow<Inclusive>(x, node, acc);
+    });
   }
 
-  static void deleteTree(TreeNode *root) {
-    if (!root)
-      return;
-    deleteTree(root->left);
-    deleteTree(root->right);
-    delete root;
+  uint32_t bound(int x, bool down) const {
+    uint32_t best = npos;
+    for (uint32_t at = root(); at != npos;) {
+      const Node &node = nodes[at];
+      if (node.val == x)
+        return at;
+      bool goRight = node.val < x;
+      if (goRight == down)
+        best = at;
+      at = goRight ? node.right : node.left;
+    }
+    return best;
   }
 
-private:
-  static int diameterHelper(TreeNode *root, int &result) {
-    if (!root)
-      return 0;
-    int left = diameterHelper(root->left, result);
-    int right = diameterHelper(root->right, result);
-    result = std::max(result, left + right);
-    return 1 + std::max(left, right);
+  // Walk up to kLanes queries at once. step(x, node, index, state) updates
+  // the lane's state, which starts as the caller left it, and returns the
+  // next node, npos when the lane is done.
+  template <typename State, typename Step>
+  void descend(const int *xs, State *states, size_t n, Step step) const {
+    for (size_t base = 0; base < n; base += kLanes) {
+      size_t lanes = std::min(kLanes, n - base);
+      uint32_t at[kLanes];
+      std::fill_n(at, lanes, root());
+      for (bool active = true; active;) {
+        active = false;
+        for (size_t l = 0; l < lanes; l++) {
+          if (at[l] == npos)
+            continue;
+          at[l] = step(xs[base + l], nodes[at[l]], at[l], states[base + l]);
+          if (at[l] != npos) {
+            __builtin_prefetch(&nodes[at[l]]);
+            active = true;
+          }
+        }
+      }
+    }
   }
 
-  static int balancedHeight(TreeNode *root) {
-    if (!root)
-      return 0;
-    int left = balancedHeight(root->left);
-    int right = balancedHeight(root->right);
-    if (left == -1 || right == -1 || std::abs(left - right) > 1)
-      return -1;
-    return 1 + std::max(left, right);
+  // fn(begin, end) for blocks of queries, on exec's threads if given
+  template <typename Fn>
+  static void inBlocks(size_t n, TreeExecutor *exec, const Fn &fn) {
+    size_t blocks = (n + kBlock - 1) / kBlock;
+    auto run = [&](size_t block) {
+      fn(block * kBlock, std::min(n, (block + 1) * kBlock));
+    };
+    if (exec)
+      exec->parallelFor(blocks, run);
+    else
+      for (size_t block = 0; block < blocks; block++)
+        run(block);
   }
 
-  static bool isBSTHelper(TreeNode *root, long minVal, long maxVal) {
-    if (!root)
-      return true;
-    if (root->val <= minVal || root->val >= maxVal)
-      return false;
-    return isBSTHelper(root->left, minVal, root->val) &&
-           isBSTHelper(root->right, root->val, maxVal);
+  // fn(i, below lo, at most hi) for every non-empty range; empty ranges
+  // keep the zero their result starts with
+  template <typename Fn>
+  void inRanges(const std::vector<Range> &ranges, TreeExecutor *exec,
+                const Fn &fn) const {
+    inBlocks(ranges.size(), exec, [&](size_t begin, size_t end) {
+      size_t n = end - begin;
+      std::vector<int> los(n), his(n);
+      for (size_t i = 0; i < n; i++) {
+        los[i] = ranges[begin + i].first;
+        his[i] = ranges[begin + i].second;
+      }
+      std::vector<Below> lo(n), hi(n);
+      belowAll<false>(los.data(), lo.data(), n);
+      belowAll<true>(his.data(), hi.data(), n);
+      for (size_t i = 0; i < n; i++)
+        if (los[i] <= his[i])
+          fn(begin + i, lo[i], hi[i]);
+    });
   }
+
+  std::vector<Node> nodes;
 };
 
 // ============================================================================
 // Helper Functions
 // ============================================================================
 
-void printVector(const std::vector<int> &v, const std::string &name) {
+// Works with any range of values, e.g. TreeTraversals::inorderRange(root).
+// Unary + prints char-sized values as numbers.
+template <typename Values>
+void printVector(const Values &values, const std::string &name) {
   std::cout << name << ": [";
-  for (size_t i = 0; i < v.size(); i++) {
-    std::cout << v[i];
-    if (i < v.size() - 1)
+  bool first = true;
+  for (const auto &v : values) {
+    if (!first)
       std::cout << ", ";
+    first = false;
+    std::cout << +v;
   }
   std::cout << "]\n";
 }
 
-void printLevelOrder(const std::vector<std::vector<int>> &levels) {
+template <typename T>
+void printLevelOrder(const std::vector<std::vector<T>> &levels) {
   std::cout << "Level Order: [";
   for (size_t i = 0; i < levels.size(); i++) {
     std::cout << "[";
     for (size_t j = 0; j < levels[i].size(); j++) {
-      std::cout << levels[i][j];
+      std::cout << +levels[i][j];
       if (j < levels[i].size() - 1)
         std::cout << ", ";
     }
@@ -586,13 +6069,754 @@ void printLevelOrder(const std::vector<std::vector<int>> &levels) {
   std::cout << "]\n";
 }
 
+// ============================================================================
+// Batch Mode
+// ============================================================================
+
+// Runs trees, one LeetCode-format line each, through a fixed set of
+// operations and writes one tab-separated record of name=value fields per
+// input line, in input order. Lines that fail to parse get an
+// error=<offset>:<message> record instead.
+class BatchRunner {
+public:
+  enum Op : unsigned {
+    Serialize = 1 << 0,
+    RoundTrip = 1 << 1,
+    Inorder = 1 << 2,
+    Preorder = 1 << 3,
+    Postorder = 1 << 4,
+    LevelOrder = 1 << 5,
+    Stats = 1 << 6,
+    IsBST = 1 << 7,
+    Balanced = 1 << 8,
+    All = (1 << 9) - 1,
+  };
+
+  static constexpr unsigned kDefaultOps = Serialize | Stats;
+
+  // Comma-separated operation names, e.g. "serialize,inorder,isbst"
+  static unsigned parseOps(std::string_view list) {
+    static constexpr std::pair<std::string_view, unsigned> names[] = {
+        {"serialize", Serialize}, {"roundtrip", RoundTrip},
+        {"inorder", Inorder},     {"preorder", Preorder},
+        {"postorder", Postorder}, {"levelorder", LevelOrder},
+        {"stats", Stats},         {"isbst", IsBST},
+        {"balanced", Balanced},   {"all", All},
+    };
+    unsigned ops = 0;
+    while (!list.empty()) {
+      size_t comma = std::min(list.find(','), list.size());
+      std::string_view name = list.substr(0, comma);
+      auto it = std::find_if(std::begin(names), std::end(names),
+                             [name](const auto &n) { return n.first == name; });
+      if (it == std::end(names))
+        throw std::invalid_argument("unknown batch operation '" +
+                                    std::string(name) + "'");
+      ops |= it->second;
+      list.remove_prefix(std::min(comma + 1, list.size()));
+    }
+    return ops;
+  }
+
+  // threads > 1 runs the records through a pipeline: a reader thread,
+  // worker threads on a TreeExecutor and a writer thread that restores
+  // input order. 0 means one worker per hardware thread.
+  explicit BatchRunner(unsigned ops = kDefaultOps, unsigned threads = 1)
+      : ops(ops), exec(threads), workers(exec.threadCount()) {}
+
+  // Process every line of in and return how many records were written
+  size_t run(std::istream &in, std::ostream &out) {
+    size_t records =
+        workers.size() > 1 ? runPipeline(in, out) : runSerial(in, out);
+    out.flush();
+    return records;
+  }
+
+private:
+  static constexpr size_t kReadBlock = size_t(1) << 20;
+
+  // Per-thread state reused from record to record
+  struct Worker {
+    TreeArena arena;
+    TreeArena check; // Second tree for the round-trip comparison
+    std::string out;
+    std::string scratch;
+  };
+
+  // A block of whole lines and the records made from it. Batches are
+  // recycled, so their buffers keep their capacity from block to block.
+  struct Batch {
+    size_t seq = 0;
+    std::string input;
+    std::string output;
+  };
+
+  size_t runSerial(std::istream &in, std::ostream &out) {
+    std::string buffer;
+    size_t records = 0;
+
+    for (bool eof = false; !eof;) {
+      eof = readBlock(in, buffer);
+
+      // A line longer than a whole block is parsed while it is read
+      if (!eof && buffer.find('\n') == std::string::npos) {
+        records++;
+        eof = streamLine(in, buffer, out, workers[0]);
+      }
+
+      // Only complete lines, unless this is the end of the input
+      size_t end = eof ? buffer.size() : buffer.rfind('\n') + 1;
+      {
+        OutputSink sink(workers[0].out);
+        records += processLines(std::string_view(buffer.data(), end),
+                                workers[0], sink);
+      }
+      writeBlock(out, workers[0].out);
+      workers[0].out.clear();
+      buffer.erase(0, end);
+    }
+    return records;
+  }
+
+  // Reading, the records themselves and writing overlap. Only a fixed set
+  // of batches exists, so a reader that gets ahead waits for the writer to
+  // hand one back, and memory stays bounded however large the input is.
+  size_t runPipeline(std::istream &in, std::ostream &out) {
+    std::vector<Batch> batches(workers.size() * 2 + 2);
+    BoundedQueue<Batch *> idle(batches.size()), work(batches.size()),
+        done(batches.size());
+    for (Batch &batch : batches)
+      idle.push(&batch);
+
+    std::atomic<size_t> records{0};
+    std::mutex mutex;
+    std::condition_variable progress;
+    size_t written = 0; // Batches already written, guarded by mutex
+    std::exception_ptr error;
+
+    // A failed read ends the input early; the batches already queued are
+    // still run and written before the error is rethrown
+    std::thread reader([&] {
+      try {
+        std::string carry; // Unfinished last line of the previous block
+        Batch *batch;
+        for (size_t seq = 0; idle.pop(batch); seq++) {
+          batch->input.swap(carry);
+          carry.clear();
+          bool eof = readBlock(in, batch->input);
+
+          // Streamed straight to out, once every earlier record is written
+          if (!eof && batch->input.find('\n') == std::string::npos) {
+            std::unique_lock<std::mutex> lock(mutex);
+            progress.wait(lock, [&] { return written == seq; });
+            lock.unlock();
+            records++;
+            eof = streamLine(in, batch->input, out, streamer);
+          }
+
+          size_t end =
+              eof ? batch->input.size() : batch->input.rfind('\n') + 1;
+          carry.assign(batch->input, end);
+          batch->input.resize(end);
+          batch->seq = seq;
+          work.push(batch);
+          if (eof)
+            break;
+        }
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error)
+          error = std::current_exception();
+      }
+      work.close();
+    });
+
+    std::thread writer([&] {
+      // Batches in flight have consecutive numbers, so one slot each
+      std::vector<Batch *> pending(batches.size());
+      Batch *batch;
+      for (size_t next = 0; done.pop(batch);) {
+        pending[batch->seq % pending.size()] = batch;
+        while (Batch *ready = pending[next % pending.size()]) {
+          pending[next % pending.size()] = nullptr;
+          writeBlock(out, ready->output);
+          idle.push(ready);
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            written = ++next;
+          }
+          progress.notify_all();
+        }
+      }
+    });
+
+    exec.parallelFor(workers.size(), [&](size_t w) {
+      Batch *batch;
+      while (work.pop(batch)) {
+        batch->output.clear();
+        try {
+          OutputSink sink(batch->output);
+          records += processLines(batch->input, workers[w], sink);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (!error)
+            error = std::current_exception();
+        }
+        done.push(batch);
+      }
+    });
+    done.close();
+    writer.join();
+    reader.join();
+    if (error)
+      std::rethrow_exception(error);
+    return records;
+  }
+
+  // Append up to one block; returns true at the end of the input
+  static bool readBlock(std::istream &in, std::string &buffer) {
+    TREE_PROFILE_SCOPE("BatchRunner::read");
+    size_t old = buffer.size();
+    buffer.resize(old + kReadBlock);
+    in.read(&buffer[old], kReadBlock);
+    buffer.resize(old + static_cast<size_t>(in.gcount()));
+    TREE_PROFILE_BYTES_IN(buffer.size() - old);
+    return !in;
+  }
+
+  static void writeBlock(std::ostream &out, std::string_view records) {
+    TREE_PROFILE_SCOPE("BatchRunner::write");
+    OutputSink sink(out);
+    TREE_PROFILE_OUTPUT(sink);
+    sink.write(records);
+  }
+
+  size_t processLines(std::string_view block, Worker &worker,
+                      OutputSink &sink) {
+    size_t lines = 0;
+    while (!block.empty()) {
+      size_t nl = std::min(block.find('\n'), block.size());
+      process(block.substr(0, nl), worker, sink);
+      block.remove_prefix(std::min(nl + 1, block.size()));
+      lines++;
+    }
+    return lines;
+  }
+
+  void process(std::string_view line, Worker &worker, OutputSink &sink) {
+    if (!line.empty() && line.back() == '\r')
+      line.remove_suffix(1);
+
+    worker.arena.clear();
+    Codec::ParseStatus status;
+    TreeNode *root = Codec::deserialize(line, worker.arena, status);
+    report(root, status, worker, sink);
+  }
+
+  // Parse the line that starts buffer as the rest of it arrives, without
+  // holding it in memory, on the calling thread. Leaves what follows the
+  // line in buffer and returns true at the end of the input.
+  bool streamLine(std::istream &in, std::string &buffer, std::ostream &out,
+                  Worker &worker) {
+    worker.arena.clear();
+    Codec::ArenaStream<int> parser(worker.arena);
+    bool eof = false;
+    bool carriageReturn = false; // Held back in case it ends the line
+
+    for (;;) {
+      size_t nl = std::min(buffer.find('\n'), buffer.size());
+      bool last = nl < buffer.size() || eof;
+      std::string_view piece(buffer.data(), nl);
+      if (carriageReturn && !(last && piece.empty()))
+        parser.feed("\r");
+      carriageReturn = !piece.empty() && piece.back() == '\r';
+      if (carriageReturn)
+        piece.remove_suffix(1);
+      parser.feed(piece);
+      if (last) {
+        buffer.erase(0, std::min(nl + 1, buffer.size()));
+        break;
+      }
+      buffer.clear();
+      eof = readBlock(in, buffer);
+    }
+
+    parser.finish();
+    OutputSink sink(out);
+    report(parser.root(), parser.status(), worker, sink);
+    return eof;
+  }
+
+  void report(TreeNode *root, Codec::ParseStatus status, Worker &worker,
+              OutputSink &sink) {
+    if (!status.ok) {
+      sink.write("error=");
+      sink.writeInt(static_cast<long long>(status.offset));
+      sink.put(':');
+      sink.write(status.message);
+      sink.put('\n');
+      return;
+    }
+
+    bool first = true;
+    auto field = [&](std::string_view name) {
+      if (!first)
+        sink.put('\t');
+      first = false;
+      sink.write(name);
+      sink.put('=');
+    };
+
+    if (ops & (Serialize | RoundTrip)) {
+      worker.scratch.clear();
+      Codec::serialize(root, worker.scratch);
+    }
+    if (ops & Serialize) {
+      field("serialize");
+      sink.write(worker.scratch);
+    }
+    if (ops & RoundTrip) {
+      worker.check.clear();
+      TreeNode *copy = Codec::deserialize(worker.scratch, worker.check, status);
+      field("roundtrip");
+      sink.write(status.ok && Codec::serialize(copy) == worker.scratch
+                     ? "ok"
+                     : "mismatch");
+    }
+    if (ops & Inorder) {
+      field("inorder");
+      writeList(TreeTraversals::inorder(root), sink);
+    }
+    if (ops & Preorder) {
+      field("preorder");
+      writeList(TreeTraversals::preorder(root), sink);
+    }
+    if (ops & Postorder) {
+      field("postorder");
+      writeList(TreeTraversals::postorder(root), sink);
+    }
+    if (ops & LevelOrder) {
+      field("levelorder");
+      sink.put('[');
+      TreeTraversals::forEachLevel(
+          root, [&sink](const std::vector<int> &level, int depth) {
+            if (depth)
+              sink.put(',');
+            writeList(level, sink);
+          });
+      sink.put(']');
+    }
+    if (ops & Stats) {
+      TreeStats stats = TreeOperations::stats(root);
+      field("height");
+      sink.writeInt(stats.height);
+      field("nodes");
+      sink.writeInt(stats.nodeCount);
+      field("leaves");
+      sink.writeInt(stats.leafCount);
+      field("sum");
+      sink.writeInt(stats.sum);
+      if (root) {
+        field("min");
+        sink.writeInt(stats.minValue);
+        field("max");
+        sink.writeInt(stats.maxValue);
+        field("diameter");
+        sink.writeInt(stats.diameter);
+      }
+    }
+    if (ops & IsBST) {
+      field("isBST");
+      sink.write(TreeOperations::isBST(root) ? "yes" : "no");
+    }
+    if (ops & Balanced) {
+      field("balanced");
+      sink.write(TreeOperations::isBalanced(root) ? "yes" : "no");
+    }
+    sink.put('\n');
+  }
+
+  static void writeList(const std::vector<int> &values, OutputSink &sink) {
+    sink.put('[');
+    for (size_t i = 0; i < values.size(); i++) {
+      if (i)
+        sink.put(',');
+      sink.writeInt(values[i]);
+    }
+    sink.put(']');
+  }
+
+  unsigned ops;
+  TreeExecutor exec;
+  std::vector<Worker> workers;
+  Worker streamer; // Used by the pipeline's reader for long lines
+};
+
+// ============================================================================
+// Benchmarks
+// ============================================================================
+
+// What --bench runs; sizes and shapes default to the full matrix
+struct BenchOptions {
+  std::vector<size_t> sizes = {1000, 10000, 100000, 1000000, 10000000};
+  std::vector<std::string> shapes = {"complete", "random", "left", "right",
+                                     "sparse"};
+  double minSeconds = 0.05; // Repeat each operation for at least this long
+  bool json = false;
+};
+
+// Times codec, traversal, operation and renderer calls on generated trees,
+// held as heap nodes ("pointer"), arena nodes ("arena") and FlatTree
+// ("flat"), and reports ns/node, allocations per call and peak RSS
+class TreeBench {
+public:
+  static constexpr std::string_view kShapes[] = {"complete", "random", "left",
+                                                 "right", "sparse"};
+
+  explicit TreeBench(const BenchOptions &options, std::ostream &out)
+      : options(options), out(out) {}
+
+  void run() {
+    if (options.json)
+      out << "[\n";
+    else
+      out << std::left << std::setw(10) << "shape" << std::setw(10)
+          << "nodes" << std::setw(9) << "repr" << std::setw(20) << "op"
+          << std::right << std::setw(12) << "ns/node" << std::setw(12)
+          << "allocs" << std::setw(14) << "peak RSS KB" << "\n";
+    for (const std::string &shape : options.shapes)
+      for (size_t n : options.sizes)
+        runCase(shape, n);
+    if (options.json)
+      out << "\n]\n";
+    out.flush();
+  }
+
+  // BFS-ordered tree of exactly n nodes. Random shapes give each node
+  // zero to two children; "sparse" mostly one, so most slots are null.
+  static FlatTree generate(std::string_view shape, size_t n) {
+    if (std::find(std::begin(kShapes), std::end(kShapes), shape) ==
+        std::end(kShapes))
+      throw std::invalid_argument("unknown bench shape '" +
+                                  std::string(shape) + "'");
+    FlatTree tree;
+    tree.reserve(n);
+    std::mt19937 rng(static_cast<uint32_t>(n * 31 + shape.size()));
+    auto value = [&] { return static_cast<int>(rng() % 2000001) - 1000000; };
+    if (n)
+      tree.addNode(value());
+
+    for (uint32_t i = 0; tree.size() < n; i++) {
+      bool left = false, right = false;
+      unsigned roll = rng() % 20;
+      if (shape == "complete")
+        left = right = true;
+      else if (shape == "left")
+        left = true;
+      else if (shape == "right")
+        right = true;
+      else if (shape == "random")
+        left = roll < 10, right = roll % 2 == 0;
+      else
+        left = roll < 10, right = roll >= 9;
+      // The last open node must keep the tree growing
+      if (i + 1 == tree.size() && !left && !right)
+        left = true;
+      if (left && tree.size() < n)
+        tree.setLeft(i, tree.addNode(value()));
+      if (right && tree.size() < n)
+        tree.setRight(i, tree.addNode(value()));
+    }
+    return tree;
+  }
+
+private:
+  // Past this many nodes times levels, renderers are skipped: the compact
+  // fallback writes that many bytes several times over
+  static constexpr size_t kMaxRenderWork = 20000000;
+
+  // Swallows rendered output so only rendering is measured
+  struct NullBuffer : std::streambuf {
+    int overflow(int c) override { return traits_type::not_eof(c); }
+    std::streamsize xsputn(const char *, std::streamsize n) override {
+      return n;
+    }
+  };
+
+  void runCase(const std::string &shape, size_t n) {
+    FlatTree flat = generate(shape, n);
+    TreeArena arena;
+    TreeNode *pointer = flat.toTree();
+    TreeNode *arenaRoot = flat.toTree(arena);
+    std::string text = Codec::serialize(arenaRoot);
+    std::string binary = Codec::serializeBinary(arenaRoot, BinaryOptions());
+    size_t levels = flat.levels();
+    TreeExecutor exec;
+    NullBuffer nullBuffer;
+    std::ostream discard(&nullBuffer);
+
+    auto time = [&](std::string_view repr, std::string_view op, auto &&fn) {
+      measure(shape, n, repr, op, fn);
+    };
+
+    // Codec
+    time("pointer", "serialize",
+         [&] { return Codec::serialize(pointer).size(); });
+    time("pointer", "deserialize", [&] {
+      TreeNode *root = Codec::deserialize(text);
+      TreeOperations::deleteTree(root);
+      return root != nullptr;
+    });
+    TreeArena parsed;
+    time("arena", "deserialize", [&] {
+      parsed.clear();
+      return Codec::deserialize(text, parsed) != nullptr;
+    });
+    time("flat", "deserialize",
+         [&] { return Codec::deserializeFlat(text).size(); });
+    time("arena", "deserialize/par", [&] {
+      parsed.clear();
+      return ParallelCodec::deserialize(text, parsed, exec) != nullptr;
+    });
+    time("flat", "deserialize/par",
+         [&] { return ParallelCodec::deserializeFlat(text, exec).size(); });
+    time("flat", "serializeBinary", [&] {
+      return Codec::serializeBinary(arenaRoot, BinaryOptions()).size();
+    });
+    time("flat", "deserializeBinary", [&] {
+      return Codec::deserializeBinary(binary).size();
+    });
+
+    // Traversals and operations on both linked representations
+    for (auto [repr, root] : {std::pair<std::string_view, TreeNode *>{
+                                  "pointer", pointer},
+                              {"arena", arenaRoot}}) {
+      time(repr, "inorder",
+           [&] { return TreeTraversals::inorder(root).size(); });
+      time(repr, "preorder",
+           [&] { return TreeTraversals::preorder(root).size(); });
+      time(repr, "postorder",
+           [&] { return TreeTraversals::postorder(root).size(); });
+      time(repr, "levelOrder",
+           [&] { return TreeTraversals::levelOrder(root).size(); });
+      time(repr, "levelOrderFlat",
+           [&] { return TreeTraversals::levelOrderFlat(root).size(); });
+      time(repr, "forEachInorder", [&] {
+        long long total = 0;
+        TreeTraversals::forEachInorder(root, [&total](int v) { total += v; });
+        return total;
+      });
+      time(repr, "inorderRange", [&] {
+        long long total = 0;
+        for (int v : TreeTraversals::inorderRange(root))
+          total += v;
+        return total;
+      });
+      time(repr, "inorder/par",
+           [&] { return TreeTraversals::inorder(root, exec).size(); });
+      time(repr, "preorder/par",
+           [&] { return TreeTraversals::preorder(root, exec).size(); });
+      time(repr, "postorder/par",
+           [&] { return TreeTraversals::postorder(root, exec).size(); });
+      time(repr, "height", [&] { return TreeOperations::height(root); });
+      time(repr, "countNodes",
+           [&] { return TreeOperations::countNodes(root); });
+      time(repr, "countLeaves",
+           [&] { return TreeOperations::countLeaves(root); });
+      time(repr, "sum", [&] { return TreeOperations::sum(root); });
+      time(repr, "minValue", [&] { return TreeOperations::minValue(root); });
+      time(repr, "maxValue", [&] { return TreeOperations::maxValue(root); });
+      time(repr, "diameter", [&] { return TreeOperations::diameter(root); });
+      time(repr, "isBalanced",
+           [&] { return TreeOperations::isBalanced(root); });
+      time(repr, "isBST", [&] { return TreeOperations::isBST(root); });
+      time(repr, "stats",
+           [&] { return TreeOperations::stats(root).nodeCount; });
+      time(repr, "countNodes/par",
+           [&] { return TreeOperations::countNodes(root, exec); });
+      time(repr, "sum/par", [&] { return TreeOperations::sum(root, exec); });
+      time(repr, "minValue/par",
+           [&] { return TreeOperations::minValue(root, exec); });
+      time(repr, "maxValue/par",
+           [&] { return TreeOperations::maxValue(root, exec); });
+      time(repr, "isBST/par",
+           [&] { return TreeOperations::isBST(root, exec); });
+      TreeArena mirrored;
+      time(repr, "mirror", [&] {
+        mirrored.clear();
+        return TreeOperations::mirror(root, mirrored) != nullptr;
+      });
+      time(repr, "invert",
+           [&] { return TreeOperations::invert(root) != nullptr; });
+    }
+
+    time("flat", "height", [&] { return TreeOperations::height(flat); });
+    time("flat", "countNodes",
+         [&] { return TreeOperations::countNodes(flat); });
+    time("flat", "countLeaves",
+         [&] { return TreeOperations::countLeaves(flat); });
+    time("flat", "sum", [&] { return TreeOperations::sum(flat); });
+    time("flat", "minValue", [&] { return TreeOperations::minValue(flat); });
+    time("flat", "maxValue", [&] { return TreeOperations::maxValue(flat); });
+    time("flat", "diameter", [&] { return TreeOperations::diameter(flat); });
+    time("flat", "isBalanced",
+         [&] { return TreeOperations::isBalanced(flat); });
+    time("flat", "isBST", [&] { return TreeOperations::isBST(flat); });
+    time("flat", "intern", [&] {
+      TreeDag dag;
+      return dag.intern(flat);
+    });
+    time("flat", "queryIndex", [&] { return TreeQueryIndex(flat).size(); });
+
+    // Each vector kernel this CPU runs, against the scalar baseline
+    const int *values = flat.values().data();
+    const uint32_t *lefts = flat.leftIndices().data();
+    const uint32_t *rights = flat.rightIndices().data();
+    for (VectorKernels::Isa isa : VectorKernels::kAll) {
+      if (!VectorKernels::supported(isa))
+        continue;
+      const VectorKernels::Table &k = VectorKernels::table(isa);
+      time(k.name, "sum", [&] { return k.sum(values, n); });
+      time(k.name, "minValue", [&] { return k.min(values, n); });
+      time(k.name, "maxValue", [&] { return k.max(values, n); });
+      time(k.name, "countLeaves",
+           [&] { return k.countLeaves(lefts, rights, n); });
+    }
+
+    // Renderers, where the output stays a sensible size
+    if (n * levels <= kMaxRenderWork) {
+      time("pointer", "print", [&] {
+        TreeVisualizer::print(pointer, discard);
+        return 1;
+      });
+      time("pointer", "printBoxed", [&] {
+        TreeVisualizer::printBoxed(pointer, discard);
+        return 1;
+      });
+      time("pointer", "printLayout", [&] {
+        TreeVisualizer::printLayout(pointer, discard);
+        return 1;
+      });
+      time("pointer", "printCompact", [&] {
+        TreeVisualizer::printCompact(pointer, discard);
+        return 1;
+      });
+      // Every run after the first is a hit; a checked hit still walks
+      RenderCache cache;
+      time("pointer", "renderCache", [&] {
+        cache.print(pointer, 0, RenderCache::Mode::Ascii, discard);
+        return 1;
+      });
+      time("pointer", "renderChecked", [&] {
+        cache.printChecked(pointer, RenderCache::Mode::Ascii, discard);
+        return 1;
+      });
+    }
+
+    // Exports grow with the node count alone
+    time("pointer", "printDot", [&] {
+      TreeVisualizer::printDot(pointer, discard);
+      return 1;
+    });
+    time("pointer", "printSvg", [&] {
+      TreeVisualizer::printSvg(pointer, discard);
+      return 1;
+    });
+    time("pointer", "printJson", [&] {
+      TreeVisualizer::printJson(pointer, discard);
+      return 1;
+    });
+
+    TreeOperations::deleteTree(pointer);
+  }
+
+  template <typename Fn>
+  void measure(std::string_view shape, size_t n, std::string_view repr,
+               std::string_view op, Fn &fn) {
+    using Clock = std::chrono::steady_clock;
+    size_t reps = 0;
+    size_t allocations = allocationCount();
+    auto start = Clock::now();
+    std::chrono::duration<double> elapsed{};
+    do {
+      checksum += static_cast<long long>(fn());
+      reps++;
+      elapsed = Clock::now() - start;
+    } while (elapsed.count() < options.minSeconds);
+    allocations = allocationCount() - allocations;
+
+    double nsPerNode =
+        elapsed.count() * 1e9 / (double(reps) * std::max<size_t>(n, 1));
+    double allocsPerCall = double(allocations) / reps;
+    long rss = peakRssKb();
+
+    if (options.json) {
+      if (records++)
+        out << ",\n";
+      out << "  {\"shape\": \"" << shape << "\", \"nodes\": " << n
+          << ", \"repr\": \"" << repr << "\", \"op\": \"" << op
+          << "\", \"ns_per_node\": " << nsPerNode
+          << ", \"allocs\": " << allocsPerCall
+          << ", \"peak_rss_kb\": " << rss << "}";
+    } else {
+      out << std::left << std::setw(10) << shape << std::setw(10) << n
+          << std::setw(9) << repr << std::setw(20) << op << std::right
+          << std::fixed << std::setprecision(2) << std::setw(12) << nsPerNode
+          << std::setprecision(1) << std::setw(12) << allocsPerCall
+          << std::setw(14) << rss << "\n"
+          << std::defaultfloat;
+    }
+  }
+
+  static long peakRssKb() {
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024; // Bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+  }
+
+  const BenchOptions &options;
+  std::ostream &out;
+  size_t records = 0;
+  volatile long long checksum = 0; // Keeps results from being optimized out
+};
+
 // ============================================================================
 // Interactive Menu
 // ============================================================================
 
 class TreeApp {
 private:
+  TreeArena arena; // Owns every node of the current tree
   TreeNode *root;
+  SubtreeSizes sizes; // Remembered subtree sizes for viewport markers
+  CachedTree metrics; // Answers the statistics menu and takes the edits
+  RenderCache renders; // Redraws of an unchanged tree
+  uint64_t version = 0; // Bumped whenever root is replaced, for renders
+
+  // Drop the current tree in one go so the next one can reuse its chunks
+  void resetTree() {
+    arena.clear();
+    sizes.clear();
+    metrics.clear();
+    root = nullptr;
+    version++;
+  }
+
+  // Redraw root from metrics after an edit
+  void syncFromMetrics() {
+    arena.clear();
+    sizes.clear();
+    root = metrics.toTree(arena);
+    version++;
+  }
 
   void printWelcome() {
     std::cout << R"(
@@ -645,6 +6869,7 @@ private:
 │   3. Print tree (ASCII art)                    │
 │   4. Print tree (compact view)                 │
 │   5. Show serialized form                      │
+│  16. View subtree (path + depth)               │
 │                                                │
 │  🔄 TRAVERSALS                                 │
 │   6. Inorder traversal                         │
@@ -657,6 +6882,7 @@ private:
 │  11. Check if BST                              │
 │  12. Check if balanced                         │
 │  13. Invert/Mirror tree                        │
+│  17. Edit node (set/insert/erase/invert)       │
 │                                                │
 │  ❓ HELP                                       │
 │  14. Show input format help                    │
@@ -670,8 +6896,6 @@ private:
 public:
   TreeApp() : root(nullptr) {}
 
-  ~TreeApp() { TreeOperations::deleteTree(root); }
-
   void run() {
     printWelcome();
 
@@ -699,8 +6923,9 @@ public:
         std::getline(std::cin, input);
 
         try {
-          TreeOperations::deleteTree(root);
-          root = Codec::deserialize(input);
+          resetTree();
+          root = Codec::deserialize(input, arena);
+          metrics.assign(root);
           std::cout << "   ✅ Tree created successfully!\n";
           TreeVisualizer::print(root);
         } catch (...) {
@@ -720,33 +6945,34 @@ public:
         int ex;
         std::cin >> ex;
 
-        TreeOperations::deleteTree(root);
+        resetTree();
 
         switch (ex) {
         case 1:
-          root = Codec::deserialize("[1,2,3,4,5,6,7]");
+          root = Codec::deserialize("[1,2,3,4,5,6,7]", arena);
           break;
         case 2:
-          root = Codec::deserialize("[3,9,20,null,null,15,7]");
+          root = Codec::deserialize("[3,9,20,null,null,15,7]", arena);
           break;
         case 3:
-          root = Codec::deserialize("[1,2,null,3,null,4,null,5]");
+          root = Codec::deserialize("[1,2,null,3,null,4,null,5]", arena);
           break;
         case 4:
-          root = Codec::deserialize("[5,3,7,2,4,6,8]");
+          root = Codec::deserialize("[5,3,7,2,4,6,8]", arena);
           break;
         default:
           std::cout << "   Invalid choice.\n";
           continue;
         }
 
+        metrics.assign(root);
         std::cout << "   ✅ Example loaded!\n";
         TreeVisualizer::print(root);
         break;
       }
 
       case 3:
-        TreeVisualizer::print(root);
+        renders.print(root, version);
         break;
 
       case 4:
@@ -754,24 +6980,26 @@ public:
           std::cout << "\n❌ Tree is empty.\n";
         } else {
           std::cout << "\n🌲 Compact View:\n\n";
-          TreeVisualizer::printCompact(root);
+          renders.print(root, version, RenderCache::Mode::Compact);
         }
         break;
 
       case 5:
-        std::cout << "\n📦 Serialized: " << Codec::serialize(root) << "\n";
+        std::cout << "\n📦 Serialized: ";
+        Codec::serialize(root, std::cout);
+        std::cout << "\n";
         break;
 
       case 6:
-        printVector(TreeTraversals::inorder(root), "Inorder");
+        printVector(TreeTraversals::inorderRange(root), "Inorder");
         break;
 
       case 7:
-        printVector(TreeTraversals::preorder(root), "Preorder");
+        printVector(TreeTraversals::preorderRange(root), "Preorder");
         break;
 
       case 8:
-        printVector(TreeTraversals::postorder(root), "Postorder");
+        printVector(TreeTraversals::postorderRange(root), "Postorder");
         break;
 
       case 9:
@@ -779,27 +7007,27 @@ public:
         break;
 
       case 10: {
+        const TreeStats &stats = metrics.stats();
         std::cout << "\n📊 Tree Statistics:\n";
-        std::cout << "   Height:      " << TreeOperations::height(root) << "\n";
-        std::cout << "   Node count:  " << TreeOperations::countNodes(root)
-                  << "\n";
-        std::cout << "   Leaf count:  " << TreeOperations::countLeaves(root)
-                  << "\n";
-        std::cout << "   Sum:         " << TreeOperations::sum(root) << "\n";
+        std::cout << "   Height:      " << stats.height << "\n";
+        std::cout << "   Node count:  " << stats.nodeCount << "\n";
+        std::cout << "   Leaf count:  " << stats.leafCount << "\n";
+        std::cout << "   Sum:         " << stats.sum << "\n";
         if (root) {
-          std::cout << "   Min value:   " << TreeOperations::minValue(root)
-                    << "\n";
-          std::cout << "   Max value:   " << TreeOperations::maxValue(root)
-                    << "\n";
-          std::cout << "   Diameter:    " << TreeOperations::diameter(root)
-                    << "\n";
+          std::cout << "   Min value:   " << stats.minValue << "\n";
+          std::cout << "   Max value:   " << stats.maxValue << "\n";
+          std::cout << "   Diameter:    " << stats.diameter << "\n";
         }
+        std::cout << "   Is BST:      " << (stats.isBST ? "Yes" : "No")
+                  << "\n";
+        std::cout << "   Is Balanced: " << (stats.isBalanced ? "Yes" : "No")
+                  << "\n";
         break;
       }
 
       case 11:
         std::cout << "\n"
-                  << (TreeOperations::isBST(root)
+                  << (metrics.isBST()
                           ? "✅ This IS a valid Binary Search Tree"
                           : "❌ This is NOT a valid Binary Search Tree")
                   << "\n";
@@ -807,7 +7035,7 @@ public:
 
       case 12:
         std::cout << "\n"
-                  << (TreeOperations::isBalanced(root)
+                  << (metrics.isBalanced()
                           ? "✅ This tree IS balanced"
                           : "❌ This tree is NOT balanced")
                   << "\n";
@@ -821,10 +7049,83 @@ public:
         std::cout << "\n🔄 Original tree:\n";
         TreeVisualizer::print(root);
 
-        TreeNode *mirrored = TreeOperations::mirror(root);
+        // Drawn through a mirrored view: no node is copied
         std::cout << "\n🪞 Mirrored tree:\n";
-        TreeVisualizer::print(mirrored);
-        TreeOperations::deleteTree(mirrored);
+        TreeVisualizer::print(TreeView(root).mirror());
+        break;
+      }
+
+      case 16: {
+        std::cout << "\n🔍 Path from the root (e.g. LRL, empty for root)\n";
+        std::cout << "   👉 Path: ";
+        std::cin.ignore();
+        TreeViewport view;
+        std::getline(std::cin, view.path);
+        std::cout << "   👉 Depth (-1 for all): ";
+        if (!(std::cin >> view.depth)) {
+          std::cin.clear();
+          std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+          std::cout << "   ❌ Invalid depth.\n";
+          break;
+        }
+        view.sizes = &sizes;
+        try {
+          std::cout << "\n";
+          TreeVisualizer::printViewport(root, view);
+        } catch (const std::invalid_argument &) {
+          std::cout << "   ❌ Path may only contain L and R.\n";
+        }
+        break;
+      }
+
+      case 17: {
+        std::cout << "\n✏️  Edit commands: set, insert, erase, invert\n";
+        std::cout << "   👉 Command: ";
+        std::string command, path;
+        std::cin >> command;
+        bool needsValue = command == "set" || command == "insert";
+        if (!needsValue && command != "erase" && command != "invert") {
+          std::cout << "   ❌ Unknown command.\n";
+          break;
+        }
+        std::cout << "   👉 Path (L/R steps, - for the root): ";
+        std::cin >> path;
+        if (path == "-")
+          path.clear();
+        int val = 0;
+        if (needsValue) {
+          std::cout << "   👉 Value: ";
+          if (!(std::cin >> val)) {
+            std::cin.clear();
+            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            std::cout << "   ❌ Invalid value.\n";
+            break;
+          }
+        }
+
+        bool done;
+        try {
+          if (command == "set")
+            done = metrics.setValue(path, val);
+          else if (command == "insert")
+            done = metrics.insert(path, val);
+          else if (command == "erase")
+            done = metrics.erase(path);
+          else
+            done = metrics.invert(path);
+        } catch (const std::invalid_argument &) {
+          std::cout << "   ❌ Path may only contain L and R.\n";
+          break;
+        }
+        if (!done) {
+          std::cout << (command == "insert"
+                            ? "   ❌ That slot is taken or has no parent.\n"
+                            : "   ❌ No node at that path.\n");
+          break;
+        }
+        syncFromMetrics();
+        std::cout << "   ✅ Done!\n";
+        TreeVisualizer::print(root);
         break;
       }
 
@@ -894,6 +7195,174 @@ public:
 // Main
 // ============================================================================
 
+// --batch [FILE] [--ops LIST] [--threads N] [--profile]
+int runBatch(int argc, char *argv[]) {
+  std::ios::sync_with_stdio(false);
+  std::cin.tie(nullptr);
+
+  std::string path;
+  unsigned ops = BatchRunner::kDefaultOps;
+  unsigned threads = 1;
+  try {
+    for (int i = 2; i < argc; i++) {
+      std::string_view arg = argv[i];
+      if (arg == "--profile" || arg == "--stats") {
+        TreeProfile::enable();
+        continue;
+      }
+      if ((arg == "--ops" || arg == "--threads") && i + 1 == argc)
+        throw std::invalid_argument(std::string(arg) + " needs a value");
+      if (arg == "--ops")
+        ops = BatchRunner::parseOps(argv[++i]);
+      else if (arg == "--threads")
+        threads = static_cast<unsigned>(std::stoul(argv[++i]));
+      else if (path.empty())
+        path = arg;
+      else
+        throw std::invalid_argument("unexpected argument '" +
+                                    std::string(arg) + "'");
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "--batch: " << e.what() << "\n";
+    return 1;
+  }
+
+  BatchRunner runner(ops, threads);
+  if (path.empty() || path == "-") {
+    runner.run(std::cin, std::cout);
+  } else {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+      std::cerr << "--batch: cannot open " << path << "\n";
+      return 1;
+    }
+    runner.run(in, std::cout);
+  }
+  // Records own stdout, so the summary goes to stderr
+  if (TreeProfile::enabled())
+    TreeProfile::reportJson(std::cerr);
+  return 0;
+}
+
+// A --sizes entry: a whole node count, written plainly or as 1e6, that
+// fits the uint32_t ids of a FlatTree
+size_t parseSize(const std::string &text) {
+  size_t used = 0;
+  double value = -1;
+  try {
+    value = std::stod(text, &used);
+  } catch (const std::logic_error &) { // Not a number, or past a double
+  }
+  if (used != text.size() || !(value >= 0) || value >= FlatTree::npos ||
+      value != std::floor(value))
+    throw std::invalid_argument("size '" + text +
+                                "' is not a node count from 0 to " +
+                                std::to_string(FlatTree::npos - 1));
+  return static_cast<size_t>(value);
+}
+
+// --bench [--sizes LIST] [--shapes LIST] [--min-time SEC] [--json]
+int runBench(int argc, char *argv[]) {
+  std::ios::sync_with_stdio(false);
+  BenchOptions options;
+  auto split = [](std::string_view list) {
+    std::vector<std::string> items;
+    while (!list.empty()) {
+      size_t comma = std::min(list.find(','), list.size());
+      items.emplace_back(list.substr(0, comma));
+      list.remove_prefix(std::min(comma + 1, list.size()));
+    }
+    return items;
+  };
+
+  try {
+    for (int i = 2; i < argc; i++) {
+      std::string_view arg = argv[i];
+      if (arg == "--json") {
+        options.json = true;
+        continue;
+      }
+      if (i + 1 == argc)
+        throw std::invalid_argument(std::string(arg) + " needs a value");
+      if (arg == "--sizes") {
+        options.sizes.clear();
+        for (const std::string &size : split(argv[++i]))
+          options.sizes.push_back(parseSize(size));
+      } else if (arg == "--shapes") {
+        options.shapes = split(argv[++i]);
+        for (const std::string &shape : options.shapes)
+          TreeBench::generate(shape, 0); // Rejects unknown names
+      } else if (arg == "--min-time") {
+        options.minSeconds = std::stod(argv[++i]);
+      } else {
+        throw std::invalid_argument("unexpected argument '" +
+                                    std::string(arg) + "'");
+      }
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "--bench: " << e.what() << "\n";
+    return 1;
+  }
+
+  TreeBench(options, std::cout).run();
+  return 0;
+}
+
+// --export dot|svg|json [FILE]
+int runExport(int argc, char *argv[]) {
+  std::ios::sync_with_stdio(false);
+  using Export = void (*)(TreeView, std::ostream &);
+  std::string_view format = argc > 2 ? argv[2] : "";
+  Export write = format == "dot"    ? Export(TreeVisualizer::printDot)
+                 : format == "svg"  ? Export(TreeVisualizer::printSvg)
+                 : format == "json" ? Export(TreeVisualizer::printJson)
+                                    : nullptr;
+  if (!write || argc > 4) {
+    std::cerr << "--export: expected dot, svg or json and at most one FILE\n";
+    return 1;
+  }
+
+  // The first line is parsed as it is read, so only the tree is held. A
+  // '\r' ending a block waits to see whether the line ends after it.
+  TreeArena arena;
+  Codec::ArenaStream<int> parser(arena);
+  auto feedLine = [&parser](std::istream &in) {
+    std::vector<char> block(size_t(1) << 16);
+    bool heldReturn = false;
+    while (in.read(block.data(), block.size()) || in.gcount() > 0) {
+      std::string_view piece(block.data(), in.gcount());
+      size_t end = piece.find('\n');
+      bool last = end != std::string_view::npos;
+      piece = piece.substr(0, end);
+      if (heldReturn && !(last && end == 0) && !parser.feed("\r"))
+        return;
+      heldReturn = !piece.empty() && piece.back() == '\r';
+      if (heldReturn)
+        piece.remove_suffix(1);
+      if (!parser.feed(piece) || last)
+        return;
+    }
+  };
+
+  std::string path = argc > 3 ? argv[3] : "-";
+  if (path == "-") {
+    feedLine(std::cin);
+  } else {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+      std::cerr << "--export: cannot open " << path << "\n";
+      return 1;
+    }
+    feedLine(in);
+  }
+  if (!parser.finish()) {
+    std::cerr << "--export: " << parser.status().message << "\n";
+    return 1;
+  }
+  write(parser.root(), std::cout);
+  return 0;
+}
+
 int main(int argc, char *argv[]) {
   if (argc > 1) {
     std::string arg = argv[1];
@@ -901,6 +7370,18 @@ int main(int argc, char *argv[]) {
       TreeApp app;
       app.runDemoTests();
       return 0;
+    } else if (arg == "--batch" || arg == "-b") {
+      return runBatch(argc, argv);
+    } else if (arg == "--bench") {
+      return runBench(argc, argv);
+    } else if (arg == "--export") {
+      return runExport(argc, argv);
+    } else if (arg == "--profile" || arg == "--stats") {
+      TreeProfile::enable();
+      TreeApp app;
+      app.run();
+      TreeProfile::report(std::cout);
+      return 0;
     } else if (arg == "--help" || arg == "-h") {
       std::cout << R"(
 🌲 Binary Tree Visualizer - LeetCode Style
@@ -908,6 +7389,23 @@ int main(int argc, char *argv[]) {
 Usage:
   ./printing_tree           Interactive mode
   ./printing_tree --test    Run demo tests
+  ./printing_tree --profile, --stats
+                            Interactive mode, then time spent per operation
+  ./printing_tree --batch [FILE] [--ops LIST] [--threads N] [--profile]
+                            One tree per line from FILE or stdin, one
+                            record per line on stdout. LIST is any of
+                            serialize,roundtrip,inorder,preorder,postorder,
+                            levelorder,stats,isbst,balanced,all
+                            (default serialize,stats); N = 0 uses every core;
+                            --profile (or --stats) writes a JSON summary
+                            to stderr
+  ./printing_tree --bench [--sizes LIST] [--shapes LIST] [--min-time SEC]
+                  [--json]  Time every operation on generated trees.
+                            Shapes: complete,random,left,right,sparse;
+                            sizes 1e3 to 1e7 by default
+  ./printing_tree --export dot|svg|json [FILE]
+                            Write the tree in FILE or stdin as Graphviz
+                            DOT, SVG or JSON on stdout
   ./printing_tree --help    Show this help
 
 Input Format: